@@ -0,0 +1,442 @@
+/**
+ * Benchmark harness. Every strategy registers a factory that builds a fresh
+ * tree and returns a runner applying one batch of operations. The driver
+ * runs a few untimed warm-up batches, then replays the same batches for
+ * each repetition, timing every batch on its own. It reports the median
+ * and p99 per-operation latency and the throughput as text, CSV or JSON.
+ * The latency is the batch time over the batch size, because the
+ * operations of a batch run concurrently. The first repetition is checked
+ * against a sequential reference outside the timed region. With
+ * `counters` set, hardware events of the timed batches are counted per
+ * thread, see perf_counters.h.
+ */
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fenwick.h"
+#include "fenwick_range.h"
+#include "generator.h"
+#include "perf_counters.h"
+#include "trace.h"
+
+struct BenchmarkRunner {
+    // Apply one batch, returns the int sum of its query answers if `answers_queries`
+    std::function<int(Span<const Operation>)> batch;
+
+    // Set instead of `batch` by the range strategies, whose batches also hold range updates
+    std::function<int(Span<const RangeOperation>)> range_batch;
+    bool answers_queries = false;
+
+    // Sum over [0, x] after the batches applied so far, unset if the tree cannot be probed
+    std::function<long long(int)> sum;
+
+    // Instrumentation report of the tree, unset if it has none
+    std::function<void(std::ostream &)> statistics;
+};
+
+struct BenchmarkStrategy {
+    std::function<BenchmarkRunner(int size)> make;
+    int range_percentage = 0; // share of range updates in the generated batches, per mille
+};
+
+class BenchmarkRegistry {
+  private:
+    std::vector<std::pair<std::string, BenchmarkStrategy>> strategies;
+
+  public:
+    void add(const std::string &name, std::function<BenchmarkRunner(int)> make, int range_percentage = 0) {
+        strategies.push_back({name, {std::move(make), range_percentage}});
+    }
+
+    const BenchmarkStrategy *find(const std::string &name) const {
+        for (const auto &[key, strategy] : strategies) {
+            if (key == name) {
+                return &strategy;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<std::string> names() const {
+        std::vector<std::string> result;
+        for (const auto &entry : strategies) {
+            result.push_back(entry.first);
+        }
+        return result;
+    }
+};
+
+// The batches of one repetition; rewind() restarts them so every repetition sees the same operations
+class BatchSource {
+  public:
+    virtual ~BatchSource() = default;
+    virtual void rewind() = 0;
+    // The next batch, empty after the last one
+    virtual Span<const Operation> next() = 0;
+    // The same for a range strategy
+    virtual Span<const RangeOperation> nextRange() = 0;
+};
+
+// `num_batches` batches drawn from a generator, recreated by `make` on every rewind
+class GeneratedBatches : public BatchSource {
+  private:
+    std::function<Generator()> make;
+    Generator generator;
+    std::vector<Operation> operations;
+    std::vector<RangeOperation> range_operations;
+    size_t num_batches;
+    size_t produced = 0;
+
+  public:
+    GeneratedBatches(std::function<Generator()> make, size_t batch_size, size_t num_batches)
+        : make(std::move(make)), generator(this->make()), operations(batch_size), num_batches(num_batches) {}
+
+    void rewind() override {
+        generator = make();
+        produced = 0;
+    }
+
+    Span<const Operation> next() override {
+        if (produced == num_batches) {
+            return {};
+        }
+        ++produced;
+        for (auto &operation : operations) {
+            operation = generator.next();
+        }
+        return operations;
+    }
+
+    Span<const RangeOperation> nextRange() override {
+        if (produced == num_batches) {
+            return {};
+        }
+        ++produced;
+        range_operations.resize(operations.size());
+        for (auto &operation : range_operations) {
+            operation = generator.nextRange();
+        }
+        return range_operations;
+    }
+};
+
+// Consecutive slices of a mapped trace, handed to the runner without copying; widened for the range strategies
+class TraceBatches : public BatchSource {
+  private:
+    const MappedTrace &trace;
+    size_t batch_size;
+    size_t offset = 0;
+    std::vector<RangeOperation> range_operations;
+
+  public:
+    TraceBatches(const MappedTrace &trace, size_t batch_size) : trace(trace), batch_size(batch_size) {}
+
+    void rewind() override {
+        offset = 0;
+    }
+
+    Span<const Operation> next() override {
+        if (offset >= trace.size()) {
+            return {};
+        }
+        auto batch = trace.slice(offset, batch_size);
+        offset += batch.size();
+        return batch;
+    }
+
+    Span<const RangeOperation> nextRange() override {
+        auto batch = next();
+        range_operations.resize(batch.size());
+        std::transform(batch.begin(), batch.end(), range_operations.begin(), widen);
+        return range_operations;
+    }
+};
+
+struct BenchmarkConfig {
+    std::string strategy;
+    int size = 0;
+    int threads = 1;
+    size_t batch_size = 0;
+    int warmup = 2;       // untimed batches before every repetition
+    int repetitions = 3;
+    bool counters = false;  // count hardware events of the timed batches
+    unsigned long long transfer_event = default_transfer_event;
+
+    // Reported with the results only, the strategy factories read their own options
+    std::string workload = "uniform";
+    int query_percentage = 0;
+    bool preprocess = false;
+    int combine_levels = 0;
+    size_t stripes = 0;
+};
+
+struct BenchmarkResult {
+    BenchmarkConfig config;
+    size_t batches = 0;               // timed batches per repetition
+    size_t operations = 0;            // timed operations per repetition
+    double seconds = 0;               // median time of a repetition
+    double mops = 0;                  // operations per second of the median repetition, in millions
+    double latency_median_ns = 0;     // median over all timed batches of the time per operation
+    double latency_p99_ns = 0;
+    std::vector<PerfCounts> counters; // per thread, over all repetitions; empty unless config.counters
+};
+
+// Nearest-rank percentile `p` in [0, 1] of `values`, which it sorts
+inline double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p * values.size());
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+/**
+ * Sequential reference of the first repetition: replays every batch with
+ * the dual BIT, which covers both point and range updates, and compares the
+ * query answers and a sample of prefix sums. The int trees wrap on
+ * overflow, so the values are compared truncated to int.
+ */
+class BenchmarkReference {
+  private:
+    FenwickTreeRangeSequential<> tree;
+    size_t batch_number = 0;
+
+  public:
+    explicit BenchmarkReference(int size) : tree(size) {}
+
+    template <typename Record>
+    bool check(const BenchmarkRunner &runner, Span<const Record> batch, int answer) {
+        int expected = 0;
+        for (const auto &operation : batch) {
+            if (operation.command == 'q') {
+                expected += (int)tree.sum(operation.index);
+            } else {
+                tree.rangeAdd(operation.index, range_end(operation), operation.value);
+            }
+        }
+        ++batch_number;
+
+        if (runner.answers_queries && answer != expected) {
+            std::cerr << "output diff at batch: " << batch_number - 1 << " t: " << answer << " s: " << expected << std::endl;
+            return false;
+        }
+        if (runner.sum) {
+            for (size_t i = 0; i < batch.size(); i += 64) {
+                int x = batch[i].index;
+                if ((int)runner.sum(x) != (int)tree.sum(x)) {
+                    std::cerr << "output diff at batch: " << batch_number - 1 << " index: " << x << std::endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Run `strategy` over the batches of `source`, returns false if the first
+ * repetition disagrees with the sequential reference. The runner of the
+ * last repetition is left in `last`, e.g. for its statistics.
+ */
+inline bool run_benchmark(const BenchmarkStrategy &strategy, const BenchmarkConfig &config, BatchSource &source,
+                          BenchmarkResult &result, BenchmarkRunner &last) {
+    using clock = std::chrono::steady_clock;
+
+    result = {};
+    result.config = config;
+    std::vector<double> latencies;
+    std::vector<double> repetition_seconds;
+
+    for (int repetition = 0; repetition < std::max(config.repetitions, 1); ++repetition) {
+        BenchmarkRunner runner = strategy.make(config.size);
+        std::unique_ptr<BenchmarkReference> reference;
+        if (repetition == 0) {
+            reference = std::make_unique<BenchmarkReference>(config.size);
+        }
+        // Counted only once opened, after the warm-up
+        PerfCounters perf(config.transfer_event);
+
+        // Time the next batch, of range records for the range strategies; its size, 0 after the last, -1 on a mismatch
+        auto step = [&](double &seconds) -> long long {
+            auto apply = [&](auto batch, const auto &apply_batch) -> long long {
+                if (batch.empty()) {
+                    return 0;
+                }
+                perf.enable();
+                auto start_time = clock::now();
+                int answer = apply_batch(batch);
+                seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+                perf.disable();
+                if (reference && !reference->check(runner, batch, answer)) {
+                    return -1;
+                }
+                return (long long)batch.size();
+            };
+            return runner.range_batch ? apply(source.nextRange(), runner.range_batch) : apply(source.next(), runner.batch);
+        };
+
+        source.rewind();
+        double seconds = 0;
+        for (int i = 0; i < config.warmup; ++i) {
+            long long size = step(seconds);
+            if (size < 0) {
+                return false;
+            }
+            if (size == 0) {
+                break;
+            }
+        }
+
+        if (config.counters) {
+            perf.open();
+        }
+
+        source.rewind();
+        double total = 0;
+        size_t batches = 0;
+        size_t operations = 0;
+        for (long long size = step(seconds); size != 0; size = step(seconds)) {
+            if (size < 0) {
+                return false;
+            }
+            total += seconds;
+            ++batches;
+            operations += size;
+            latencies.push_back(seconds * 1e9 / size);
+        }
+
+        if (config.counters) {
+            accumulate_counts(result.counters, perf.read());
+        }
+        repetition_seconds.push_back(total);
+        result.batches = batches;
+        result.operations = operations;
+        last = std::move(runner);
+    }
+
+    result.seconds = percentile(repetition_seconds, 0.5);
+    result.mops = result.seconds > 0 ? result.operations / result.seconds / 1e6 : 0;
+    result.latency_median_ns = percentile(latencies, 0.5);
+    result.latency_p99_ns = percentile(latencies, 0.99);
+    return true;
+}
+
+// Average count of `event` per timed operation, -1 if it was not counted
+inline double counts_per_operation(const BenchmarkResult &result, int event) {
+    const PerfCounts total = total_counts(result.counters);
+    const double operations = (double)result.operations * std::max(result.config.repetitions, 1);
+    if (!total.counted(event) || operations == 0) {
+        return -1;
+    }
+    return total.values[event] / operations;
+}
+
+// Write `value`, or `missing` if it is negative
+inline void write_count(std::ostream &out, double value, const char *missing) {
+    if (value < 0) {
+        out << missing;
+    } else {
+        out << value;
+    }
+}
+
+inline void write_result_text(std::ostream &out, const BenchmarkResult &result) {
+    out << "Performance:" << std::endl;
+    out << "Strategy: " << result.config.strategy << std::endl;
+    out << "Threads: " << result.config.threads << std::endl;
+    out << "Total operations: " << result.operations << " x " << result.config.repetitions << " repetitions" << std::endl;
+    out << "Repetition time (median): " << result.seconds << " seconds" << std::endl;
+    out << "Throughput: " << result.mops << " Mops/s" << std::endl;
+    out << "Latency per operation (median): " << result.latency_median_ns << " ns" << std::endl;
+    out << "Latency per operation (p99): " << result.latency_p99_ns << " ns" << std::endl;
+    if (!result.counters.empty()) {
+        out << "Events per operation:";
+        for (int event = 0; event != num_perf_events; ++event) {
+            out << ' ' << perf_event_name(event) << ' ';
+            write_count(out, counts_per_operation(result, event), "n/a");
+        }
+        out << std::endl;
+        for (size_t t = 0; t != result.counters.size(); ++t) {
+            out << "Events of thread " << t << ":";
+            for (int event = 0; event != num_perf_events; ++event) {
+                out << ' ' << perf_event_name(event) << ' ';
+                write_count(out, result.counters[t].values[event], "n/a");
+            }
+            out << std::endl;
+        }
+    }
+    out << std::endl;
+}
+
+inline void write_result_csv_header(std::ostream &out) {
+    out << "strategy,threads,size,batch_size,batches,repetitions,workload,queries,preprocess,combine_levels,stripes,"
+        << "seconds,mops,latency_median_ns,latency_p99_ns";
+    for (int event = 0; event != num_perf_events; ++event) {
+        out << ',' << perf_event_name(event) << "_per_op";
+    }
+    out << std::endl;
+}
+
+inline void write_result_csv(std::ostream &out, const BenchmarkResult &result) {
+    out << result.config.strategy << ',' << result.config.threads << ',' << result.config.size << ','
+        << result.config.batch_size << ',' << result.batches << ',' << result.config.repetitions << ','
+        << result.config.workload << ',' << result.config.query_percentage << ',' << result.config.preprocess << ','
+        << result.config.combine_levels << ',' << result.config.stripes << ','
+        << result.seconds << ',' << result.mops << ',' << result.latency_median_ns << ','
+        << result.latency_p99_ns;
+    for (int event = 0; event != num_perf_events; ++event) {
+        out << ',';
+        write_count(out, counts_per_operation(result, event), "");
+    }
+    out << std::endl;
+}
+
+inline void write_result_json(std::ostream &out, const BenchmarkResult &result) {
+    out << "{\"strategy\": \"" << result.config.strategy << "\""
+        << ", \"threads\": " << result.config.threads
+        << ", \"size\": " << result.config.size
+        << ", \"batch_size\": " << result.config.batch_size
+        << ", \"batches\": " << result.batches
+        << ", \"repetitions\": " << result.config.repetitions
+        << ", \"workload\": \"" << result.config.workload << "\""
+        << ", \"queries\": " << result.config.query_percentage
+        << ", \"preprocess\": " << (result.config.preprocess ? "true" : "false")
+        << ", \"combine_levels\": " << result.config.combine_levels
+        << ", \"stripes\": " << result.config.stripes
+        << ", \"seconds\": " << result.seconds
+        << ", \"mops\": " << result.mops
+        << ", \"latency_median_ns\": " << result.latency_median_ns
+        << ", \"latency_p99_ns\": " << result.latency_p99_ns;
+    if (!result.counters.empty()) {
+        out << ", \"counters\": {";
+        for (int event = 0; event != num_perf_events; ++event) {
+            out << '"' << perf_event_name(event) << "_per_op\": ";
+            write_count(out, counts_per_operation(result, event), "null");
+            out << ", ";
+        }
+        out << "\"threads\": [";
+        for (size_t t = 0; t != result.counters.size(); ++t) {
+            out << (t == 0 ? "{" : ", {");
+            for (int event = 0; event != num_perf_events; ++event) {
+                out << (event == 0 ? "\"" : ", \"") << perf_event_name(event) << "\": ";
+                write_count(out, result.counters[t].values[event], "null");
+            }
+            out << '}';
+        }
+        out << "]}";
+    }
+    out << "}" << std::endl;
+}
+
+#endif
@@ -2,17 +2,28 @@
 #define FENWICK_H
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <chrono>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include <omp.h>
 
 #include "generator.h"
+#include "fold_kernels.h"
+#include "instrumentation.h"
+#include "snapshot.h"
+#include "topology.h"
+#include "tree_allocator.h"
 
+// Thin type-erased interface so the CLI can drive any tree through one handle
 class FenwickTreeBase {
   public:
     virtual ~FenwickTreeBase() = default;
@@ -20,674 +31,1802 @@ class FenwickTreeBase {
     virtual int sum(int x) = 0;
 };
 
-// Original sequential Fenwick Tree
-class FenwickTreeSequential : public FenwickTreeBase {
+/**
+ * Non-owning view of a contiguous run of elements: a whole std::vector or a
+ * slice of a memory-mapped trace, so batchAdd() never needs a copy.
+ */
+template <typename T>
+class Span {
   private:
-    std::vector<int> bits;
+    T *first = nullptr;
+    size_t count = 0;
 
   public:
-    FenwickTreeSequential(int n):bits(n + 1, 0){}
+    Span() = default;
+    Span(T *first, size_t count) : first(first), count(count) {}
+    Span(std::vector<std::remove_const_t<T>> &v) : first(v.data()), count(v.size()) {}
+    Span(const std::vector<std::remove_const_t<T>> &v) : first(v.data()), count(v.size()) {}
+
+    T *data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t i) const { return first[i]; }
+    T *begin() const { return first; }
+    T *end() const { return first + count; }
+
+    Span subspan(size_t offset, size_t n) const {
+        return Span(first + offset, std::min(n, count - offset));
+    }
+};
 
-    void add(int x, int val) override {
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x] += val;
+/**
+ * Combining operators for the tree. An operator must be associative and
+ * commutative, and `identity()` must be its neutral element.
+ */
+template <typename T>
+struct Plus {
+    static constexpr T identity() { return T(0); }
+    constexpr T operator()(const T &a, const T &b) const { return a + b; }
+};
+
+template <typename T>
+struct Max {
+    static constexpr T identity() { return std::numeric_limits<T>::lowest(); }
+    constexpr T operator()(const T &a, const T &b) const { return std::max(a, b); }
+};
+
+// Combine `val` into an atomic node; plain integer sums use fetch_add
+template <typename T, typename Op>
+inline void atomic_combine(std::atomic<T> &node, const T &val, const Op &op,
+                           std::memory_order order = std::memory_order_seq_cst) {
+    if constexpr (std::is_integral_v<T> && std::is_same_v<Op, Plus<T>>) {
+        node.fetch_add(val, order);
+    } else {
+        T expected = node.load(std::memory_order_relaxed);
+        while (!node.compare_exchange_weak(expected, op(expected, val), order, std::memory_order_relaxed)) {}
+    }
+}
+
+/**
+ * Compute the smallest index derived from `x` that lies
+ * within the target range starting at `lower`.
+ *
+ * This avoids having each thread start from the original
+ * `x` and loop through unnecessarily to locate their valid
+ * range.
+ */
+template <typename Index>
+inline Index enter_range(Index x, Index lower) {
+    if (x < lower) {
+        auto highest_diff_bit
+            = 0x8000000000000000ULL >> __builtin_clzll((unsigned long long)(x ^ lower));
+
+        // Rounding up below the lowest set bit of `x` would leave its update path
+        highest_diff_bit = std::max(highest_diff_bit, (unsigned long long)(x & -x));
+
+        x |= highest_diff_bit;
+        x &= ~(highest_diff_bit - 1);
+
+        if (x < lower) {
+            x += x & -x;
         }
     }
+    return x;
+}
+
+// Largest node on the query path of `x` (x, x - lowbit(x), ...) that lies below `upper`
+template <typename Index>
+inline Index below_range(Index x, Index upper) {
+    if (x >= upper) {
+        if (x != upper) {
+            auto highest_diff_bit
+                = 0x8000000000000000ULL >> __builtin_clzll((unsigned long long)(x ^ upper));
+
+            // Keep only the prefix shared with `upper`
+            x &= ~((highest_diff_bit << 1) - 1);
+        }
 
-    int sum(int x) override {
-        int total = 0;
+        if (x >= upper) {
+            x -= x & -x;
+        }
+    }
+    return x;
+}
+
+/**
+ * LSD radix sort of [first, last) by key, all of which lie in [lower, upper).
+ * Returns whichever of `first` or `swap` holds the sorted sequence.
+ */
+template <typename Key, typename Value>
+std::pair<Key, Value> *radix_sort_by_key(std::pair<Key, Value> *first, std::pair<Key, Value> *last,
+                                         std::pair<Key, Value> *swap, Key lower, Key upper) {
+    constexpr int digit_bits = 11;
+    constexpr size_t radix = size_t(1) << digit_bits;
+    const size_t count = last - first;
+    const unsigned long long width = (unsigned long long)(upper - lower);
+
+    if (count < 2 || width < 2) {
+        return first;
+    }
+
+    size_t histogram[radix];
+    for (int shift = 0; shift < 64 && (width - 1) >> shift; shift += digit_bits) {
+        std::fill(histogram, histogram + radix, 0);
+        for (size_t i = 0; i != count; ++i) {
+            ++histogram[((unsigned long long)(first[i].first - lower) >> shift) & (radix - 1)];
+        }
+
+        size_t offset = 0;
+        for (auto &bucket : histogram) {
+            size_t bucket_count = bucket;
+            bucket = offset;
+            offset += bucket_count;
+        }
+
+        for (size_t i = 0; i != count; ++i) {
+            swap[histogram[((unsigned long long)(first[i].first - lower) >> shift) & (radix - 1)]++] = first[i];
+        }
+        std::swap(first, swap);
+    }
+    return first;
+}
+
+// Tag of the constructors that leave the nodes unset, to be first-touched by their owner threads
+struct Uninitialized {};
+
+// Core Fenwick Tree parameterized on value type, index type and combining operator.
+// Every strategy below is built on it; the walks are non-virtual and get inlined.
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTree {
+  public:
+    using value_type = T;
+    using index_type = Index;
+    using op_type = Op;
+
+  protected:
+    std::vector<T, TreeAllocator<T>> bits;
+    Op op;
+
+  public:
+    explicit FenwickTree(Index n) : bits(n + 1, Op::identity()) {}
+
+    // The nodes hold garbage until clearWithin() covered all of [0, size()]
+    FenwickTree(Index n, Uninitialized) : bits(n + 1) {}
+
+    Index size() const {
+        return (Index)bits.size() - 1;
+    }
+
+    // Raw nodes, 1-based: data()[x] for x in [1, size()]
+    const T *data() const {
+        return bits.data();
+    }
+
+    // All nodes, for write_snapshot() or a BackgroundCheckpoint
+    SnapshotView snapshot() const {
+        static_assert(std::is_trivially_copyable_v<T>, "snapshots copy the nodes bytewise");
+        SnapshotView view;
+        view.add(bits.data(), bits.size());
+        return view;
+    }
+
+    // Copy the nodes of a snapshot of a tree of the same size and value type, returns false if it is not one
+    bool restore(const MappedSnapshot &snapshot) {
+        const T *nodes = snapshot.numArrays() == 1 ? snapshot.array<T>(0, bits.size()) : nullptr;
+        if (!nodes) {
+            return false;
+        }
+        std::copy(nodes, nodes + bits.size(), bits.begin());
+        return true;
+    }
+
+    // Linear-time construction from values[0, n); entries past n start at the identity
+    void build(const T *values, size_t n) {
+        const Index end = (Index)bits.size();
+        for (Index x = 1; x < end; ++x) {
+            bits[x] = (size_t)(x - 1) < n ? values[x - 1] : Op::identity();
+        }
+        for (Index x = 1; x < end; ++x) {
+            Index next_x = x + (x & -x);
+            if (next_x < end) {
+                bits[next_x] = op(bits[next_x], bits[x]);
+            }
+        }
+    }
+
+    // OpenMP version of build() over evenly sized ranges, one per thread
+    void buildParallel(const T *values, size_t n) {
+        const Index end = (Index)bits.size();
+        const int num_threads = omp_get_max_threads();
+        std::vector<std::pair<Index, Index>> ranges(num_threads);
+        for (int t = 0; t != num_threads; ++t) {
+            ranges[t].first = 1 + (Index)((long long)(end - 1) * t / num_threads);
+            ranges[t].second = 1 + (Index)((long long)(end - 1) * (t + 1) / num_threads);
+        }
+        buildRanges(values, n, ranges);
+    }
+
+    void add(Index x, T val) {
+        for (++x; x < (Index)bits.size(); x += x & -x) {
+            bits[x] = op(bits[x], val);
+        }
+    }
+
+    T sum(Index x) const {
+        T total = Op::identity();
         for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
+            total = op(total, bits[x]);
+        }
+        return total;
+    }
+
+    // Reset the nodes [lower, upper) to the identity; called by the owner thread, it first-touches them
+    void clearWithin(Index lower, Index upper) {
+        std::fill(bits.begin() + lower, bits.begin() + upper, Op::identity());
+    }
+
+    // Apply `val` to the nodes on the update path of the 1-based node `x` that lie in [lower, upper)
+    void addWithin(Index x, T val, Index lower, Index upper) {
+        for (x = enter_range(x, lower); x < upper; x += x & -x) {
+            bits[x] = op(bits[x], val);
+        }
+    }
+
+    // Combine the nodes on the query path of the 1-based node `x` that lie in [lower, upper)
+    T sumWithin(Index x, Index lower, Index upper) const {
+        T total = Op::identity();
+        for (x = below_range(x, upper); x >= lower && x > 0; x -= x & -x) {
+            total = op(total, bits[x]);
         }
         return total;
     }
 
-    void batchAdd(std::vector<Operation> &operations) {
+    // Answer out[i] = sum(idx[i]) for the k queries one at a time
+    void batchSum(const Index *idx, T *out, size_t k) const {
+        for (size_t i = 0; i != k; ++i) {
+            out[i] = sum(idx[i]);
+        }
+    }
+
+    /**
+     * OpenMP batchSum(): each thread radix sorts its slice of the queries, so
+     * that consecutive queries share the nodes of their common high-order
+     * bits. acc[b] holds the combination of the nodes (x >> b) << b of the
+     * previous query x, so a query only walks the bits at and below its
+     * highest bit differing from the previous one.
+     */
+    void batchSumParallel(const Index *idx, T *out, size_t k) const {
+        std::vector<std::pair<Index, size_t>> order(k), swap(k);
+
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num();
+            int p = omp_get_num_threads();
+            const size_t begin = k * t / p;
+            const size_t end = k * (t + 1) / p;
+
+            for (size_t i = begin; i != end; ++i) {
+                order[i] = {idx[i] + 1, i};
+            }
+            const auto *sorted = radix_sort_by_key(order.data() + begin, order.data() + end, swap.data() + begin,
+                                                   (Index)1, (Index)bits.size());
+
+            T acc[65];
+            std::fill(acc, acc + 65, Op::identity());
+            unsigned long long prev = 0;
+
+            for (size_t i = 0; i != end - begin; ++i) {
+                const unsigned long long x = sorted[i].first;
+                if (x != prev) {
+                    for (int b = 63 - __builtin_clzll(x ^ prev); b >= 0; --b) {
+                        acc[b] = (x >> b) & 1 ? op(acc[b + 1], bits[(x >> b) << b]) : acc[b + 1];
+                    }
+                    prev = x;
+                }
+                out[sorted[i].second] = acc[0];
+            }
+        }
+    }
+
+    /**
+     * Smallest x with sum(x) >= k, or size() if there is none, in O(log n)
+     * by binary lifting: descend from the highest power of two and step
+     * over node pos + step whenever the prefix combined so far stays below
+     * k. The prefix sums must be monotone, e.g. Plus over non-negative
+     * values or Max.
+     */
+    Index lowerBound(T k) const {
+        const Index n = size();
+        if (n <= 0) {
+            return 0;
+        }
+        Index pos = 0;
+        T acc = Op::identity();
+        for (Index step = Index(1) << (63 - __builtin_clzll((unsigned long long)n)); step > 0; step >>= 1) {
+            if (pos + step <= n) {
+                T next = op(acc, bits[pos + step]);
+                if (next < k) {
+                    pos += step;
+                    acc = next;
+                }
+            }
+        }
+        return pos;
+    }
+
+    // Answer out[i] = lowerBound(keys[i]) for the k searches with OpenMP, the tree must not change meanwhile
+    void batchLowerBound(const T *keys, Index *out, size_t k) const {
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < k; ++i) {
+            out[i] = lowerBound(keys[i]);
+        }
+    }
+
+  protected:
+    /**
+     * Parallel build(): each thread copies and folds its own range of
+     * `ranges`, which must partition [1, size()]. A node whose parent lies
+     * past its range is recorded as a carry and its value is then applied
+     * along the parent's whole update path. There are at most one such node
+     * per level and range boundary, so this last step is O(p log^2 n).
+     */
+    void buildRanges(const T *values, size_t n, const std::vector<std::pair<Index, Index>> &ranges) {
+        const Index end = (Index)bits.size();
+        std::vector<std::vector<std::pair<Index, T>>> carries(ranges.size());
+
+        #pragma omp parallel for schedule(static, 1)
+        for (size_t t = 0; t < ranges.size(); ++t) {
+            const auto [lower, upper] = ranges[t];
+            for (Index x = lower; x < upper; ++x) {
+                bits[x] = (size_t)(x - 1) < n ? values[x - 1] : Op::identity();
+            }
+            for (Index x = lower; x < upper; ++x) {
+                Index next_x = x + (x & -x);
+                if (next_x < upper) {
+                    bits[next_x] = op(bits[next_x], bits[x]);
+                } else if (next_x < end) {
+                    carries[t].emplace_back(next_x, bits[x]);
+                }
+            }
+        }
+
+        for (const auto &range_carries : carries) {
+            for (auto [x, val] : range_carries) {
+                for (; x < end; x += x & -x) {
+                    bits[x] = op(bits[x], val);
+                }
+            }
+        }
+    }
+};
+
+// Original sequential Fenwick Tree
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeSequential : public FenwickTree<T, Index, Op> {
+  private:
+    using Base = FenwickTree<T, Index, Op>;
+
+  public:
+    FenwickTreeSequential(Index n) : Base(n) {}
+
+    // The nodes are left unset until the owner clears them with clearWithin(0, n + 1)
+    FenwickTreeSequential(Index n, Uninitialized) : Base(n, Uninitialized()) {}
+
+    void batchAdd(Span<const Operation> operations) {
         for (auto &operation : operations) {
-            int x = operation.index;
-            int val = operation.value;
+            Base::add(operation.index, operation.value);
+        }
+    }
+};
+
+/**
+ * Sequential Fenwick Tree of the fixed size 2^LogN - 1: the walks are
+ * bounded by a compile-time constant instead of the runtime bits.size(),
+ * and the nodes live in a cache-line aligned array inside the tree.
+ * While the tree fits in L2 (LogN <= 16) an add runs the constant LogN
+ * levels with no branch: level b combines into bits[x] the value if bit b
+ * of x is set and the identity otherwise, then carries past the bit. Past
+ * that, the extra writes cost more than the exit mispredict they save,
+ * and so do branch-free queries at every size, so those keep the loop.
+ */
+template <int LogN, typename T = int, typename Op = Plus<T>>
+class FenwickTreeFixed {
+  public:
+    using value_type = T;
+    using op_type = Op;
+
+    static_assert(LogN > 0 && LogN < 31, "FenwickTreeFixed supports 2^1 - 1 to 2^30 - 1 entries");
+    static constexpr int capacity = (1 << LogN) - 1;
+
+  private:
+    static constexpr bool branch_free_add = LogN <= 16;
+
+    // bits[2^LogN] only absorbs the identity the branch-free add writes past the end of a path
+    alignas(64) std::array<T, capacity + 2> bits;
+    Op op;
 
-            for (++x; x < (int)bits.size(); x += x & -x) {
-                bits[x] += val;
+  public:
+    FenwickTreeFixed() {
+        bits.fill(Op::identity());
+    }
+
+    static constexpr int size() {
+        return capacity;
+    }
+
+    SnapshotView snapshot() const {
+        SnapshotView view;
+        view.add(bits.data(), bits.size());
+        return view;
+    }
+
+    bool restore(const MappedSnapshot &snapshot) {
+        const T *nodes = snapshot.numArrays() == 1 ? snapshot.array<T>(0, bits.size()) : nullptr;
+        if (!nodes) {
+            return false;
+        }
+        std::copy(nodes, nodes + bits.size(), bits.begin());
+        return true;
+    }
+
+    void add(int i, T val) {
+        unsigned x = i + 1;
+        if constexpr (branch_free_add) {
+            #pragma GCC unroll 32
+            for (int b = 0; b < LogN; ++b) {
+                const unsigned bit = x & (1u << b);
+                bits[x] = op(bits[x], bit ? val : Op::identity());
+                x += bit;
+            }
+        } else {
+            for (; x <= (unsigned)capacity; x += x & -x) {
+                bits[x] = op(bits[x], val);
             }
         }
     }
+
+    T sum(int i) const {
+        T total = Op::identity();
+        for (unsigned x = i + 1; x > 0; x -= x & -x) {
+            total = op(total, bits[x]);
+        }
+        return total;
+    }
+
+    void batchAdd(Span<const Operation> operations) {
+        for (auto &operation : operations) {
+            add(operation.index, operation.value);
+        }
+    }
 };
 
-// Improved parallel Fenwick Tree
-class FenwickTreeLocked : public FenwickTreeBase {
+/**
+ * Blocked (B-ary) Fenwick Tree: the flat `bits` array is replaced by levels
+ * of aligned blocks of B = BlockBytes / sizeof(T) nodes. Node j of a block
+ * holds the prefix of its block's entries up to j, and level k + 1 holds
+ * one entry per block of level k (its total). A query reads one node per
+ * level and an add updates one block per level with a fixed-width masked
+ * loop the compiler vectorizes, so a 2^24 tree with cache-line blocks costs
+ * 6 lines per operation and no data-dependent branches.
+ */
+template <typename T = int, typename Index = int, typename Op = Plus<T>, size_t BlockBytes = 64>
+class FenwickTreeBlocked {
+  public:
+    using value_type = T;
+    using index_type = Index;
+    using op_type = Op;
+
   private:
-    std::vector<int> bits;
-    std::vector<std::mutex> mutexes;
+    static constexpr Index B = BlockBytes / sizeof(T);
+    static constexpr int block_bits = __builtin_ctzll(B);
+    static_assert(B >= 2 && (B & (B - 1)) == 0, "a block must hold a power-of-two number of nodes");
+
+    struct alignas(BlockBytes) Block {
+        T nodes[B];
+    };
+
+    Index n;
+    // levels[k] is the offset of level k in `blocks`, bottom level first
+    std::vector<Index> levels;
+    std::vector<Block> blocks;
+    Op op;
 
   public:
-    FenwickTreeLocked(int n) : bits(n + 1), mutexes(n + 1) {
-        // Already initialized to 0 in constructor
+    FenwickTreeBlocked(Index n) : n(n) {
+        Index count = std::max<Index>(n, 1);
+        Index total_blocks = 0;
+        while (true) {
+            Index num_blocks = (count + B - 1) >> block_bits;
+            levels.push_back(total_blocks);
+            total_blocks += num_blocks;
+            if (num_blocks == 1) {
+                break;
+            }
+            count = num_blocks;
+        }
+
+        Block empty;
+        std::fill(empty.nodes, empty.nodes + B, Op::identity());
+        blocks.assign(total_blocks, empty);
     }
 
-    // Thread-safe add operation with local lock
-    void add(int x, int val) {
-        // TODO: make this variable more scalable
-        const int lock_size = 16384;
-        ++x;
-        // Update the tree
-        std::unique_lock<std::mutex> lock(mutexes[x / lock_size]);
-        int prev_x = x;
-        for (; x < (int)bits.size(); x += x & -x) {
-            if (prev_x / lock_size != x / lock_size) {
-                lock.unlock();
-                lock = std::unique_lock<std::mutex>(mutexes[x / lock_size]);
-                prev_x = x;
+    Index size() const {
+        return n;
+    }
+
+    // The blocks of all levels; the level offsets follow from the size
+    SnapshotView snapshot() const {
+        SnapshotView view;
+        view.add(blocks.data(), blocks.size());
+        return view;
+    }
+
+    bool restore(const MappedSnapshot &snapshot) {
+        const Block *nodes = snapshot.numArrays() == 1 ? snapshot.array<Block>(0, blocks.size()) : nullptr;
+        if (!nodes) {
+            return false;
+        }
+        std::copy(nodes, nodes + blocks.size(), blocks.begin());
+        return true;
+    }
+
+    // Linear-time construction from values[0, count); blocks of a level are built in parallel
+    void build(const T *values, size_t count) {
+        std::vector<T> entries, totals;
+        const T *source = values;
+        for (size_t k = 0; k != levels.size(); ++k) {
+            Index num_blocks = (k + 1 != levels.size() ? levels[k + 1] : (Index)blocks.size()) - levels[k];
+            totals.resize(num_blocks);
+
+            #pragma omp parallel for
+            for (Index b = 0; b < num_blocks; ++b) {
+                T *nodes = blocks[levels[k] + b].nodes;
+                T running = Op::identity();
+                for (Index j = 0; j < B; ++j) {
+                    size_t entry = ((size_t)b << block_bits) + j;
+                    running = op(running, entry < count ? source[entry] : Op::identity());
+                    nodes[j] = running;
+                }
+                totals[b] = running;
             }
-            bits[x] += val;
+
+            entries.swap(totals);
+            source = entries.data();
+            count = num_blocks;
         }
     }
 
-    // Thread-safe sum operation (no locks needed with atomics)
-    int sum(int x) {
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
+    void add(Index x, T val) {
+        for (Index level : levels) {
+            T *nodes = blocks[level + (x >> block_bits)].nodes;
+            Index offset = x & (B - 1);
+            #pragma omp simd
+            for (Index j = 0; j < B; ++j) {
+                nodes[j] = op(nodes[j], j >= offset ? val : Op::identity());
+            }
+            x >>= block_bits;
+        }
+    }
+
+    T sum(Index x) const {
+        T total = Op::identity();
+        for (Index level : levels) {
+            total = op(total, blocks[level + (x >> block_bits)].nodes[x & (B - 1)]);
+
+            // The blocks before this one are summed one level up
+            x >>= block_bits;
+            if (x == 0) {
+                break;
+            }
+            --x;
         }
         return total;
     }
+
+    void batchAdd(Span<const Operation> operations) {
+        for (auto &operation : operations) {
+            add(operation.index, operation.value);
+        }
+    }
 };
 
-// Model-Parallel Fenwick Tree - Fixed Size
-class FenwickTreeModelParallel : public FenwickTreeBase {
+// Spin-wait backoff: pause, and yield the core once the wait is long (e.g. the holder got preempted)
+inline void cpu_relax(unsigned &spins) {
+    if (++spins < 1024) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+// Test-and-test-and-set spinlock, waiters spin on a shared read until the lock looks free
+class SpinLock {
+  private:
+    std::atomic<bool> locked{false};
+
+  public:
+    void lock() {
+        unsigned spins = 0;
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+                cpu_relax(spins);
+            }
+        }
+    }
+
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+};
+
+// FIFO ticket lock, fair under contention
+class TicketLock {
+  private:
+    std::atomic<unsigned> next{0};
+    std::atomic<unsigned> serving{0};
+
+  public:
+    void lock() {
+        const unsigned ticket = next.fetch_add(1, std::memory_order_relaxed);
+        unsigned spins = 0;
+        while (serving.load(std::memory_order_acquire) != ticket) {
+            cpu_relax(spins);
+        }
+    }
+
+    void unlock() {
+        serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+// One lock per cache line so neighbouring stripes do not false-share
+template <typename Lock>
+struct alignas(64) PaddedLock : Lock {};
+
+/**
+ * Striped-lock Fenwick Tree. The levels are grouped into bands of `band_bits`
+ * levels; within band g the nodes are split into aligned regions of
+ * 2^((g + 1) * band_bits) indices, one lock each. An update path stays in
+ * the same region until it leaves the band, so a walk takes exactly one
+ * lock per band, about log(n) / band_bits in total, and never holds two.
+ * The lowest band gets at least `num_stripes` regions (rounded to a power
+ * of two region size), the higher bands add fewer and fewer locks on top.
+ */
+template <typename T = int, typename Index = int, typename Op = Plus<T>, typename Lock = SpinLock>
+class FenwickTreeLocked : public FenwickTree<T, Index, Op> {
   private:
+    using Base = FenwickTree<T, Index, Op>;
+    using Base::bits;
+    using Base::op;
+
+    int band_bits;
+    // band_offsets[g] is the index of the first lock of band g
+    std::vector<size_t> band_offsets;
+    std::vector<PaddedLock<Lock>> locks;
+
+  public:
+    FenwickTreeLocked(Index n, size_t num_stripes = 1024) : Base(n) {
+        // Already initialized to the identity in the base constructor
+        const unsigned long long nodes = (unsigned long long)n + 1;
+        num_stripes = std::max<size_t>(num_stripes, 1);
+        const unsigned long long stripe_nodes = (nodes + num_stripes - 1) / num_stripes;
+        band_bits = std::max(1, 63 - __builtin_clzll(stripe_nodes));
+
+        size_t total = 0;
+        for (int g = 0; g * band_bits < 64 && (g == 0 || (nodes >> (g * band_bits)) > 0); ++g) {
+            band_offsets.push_back(total);
+            const int region_bits = (g + 1) * band_bits;
+            total += (region_bits < 64 ? (nodes >> region_bits) : 0) + 1;
+        }
+        locks = std::vector<PaddedLock<Lock>>(total);
+    }
+
+    size_t stripes() const {
+        return locks.size();
+    }
+
+    // Thread-safe add operation, one lock per band of levels
+    void add(Index x, T val) {
+        ++x;
+        for (int g = 0; x < (Index)bits.size(); ++g) {
+            const int band_end = (g + 1) * band_bits;
+            const auto region = (unsigned long long)(x - 1) >> band_end;
+            const Index band_limit = band_end < (int)sizeof(Index) * 8 - 1 ? (Index(1) << band_end) : std::numeric_limits<Index>::max();
+            if ((x & -x) >= band_limit) {
+                continue;
+            }
+
+            std::lock_guard<Lock> lock(locks[band_offsets[g] + region]);
+            for (; x < (Index)bits.size() && (x & -x) < band_limit; x += x & -x) {
+                bits[x] = op(bits[x], val);
+            }
+        }
+    }
+
+    // Sum is inherited from the core: readers take no locks
+};
+
+// Every node costs the same
+template <typename Index>
+std::vector<long> uniform_cost(Index n) {
+    return std::vector<long>(n + 1, 1);
+}
+
+// A node costs as many writes as the number of indices whose update path goes through it
+template <typename Index>
+std::vector<long> access_cost(Index n) {
+    std::vector<long> dp(n + 1);
+    for (Index x = 1; x <= n; ++x) {
+        ++dp[x];
+
+        Index next_x = x;
+        next_x += next_x & -next_x;
+        if (next_x <= n) {
+            dp[next_x] += dp[x];
+        }
+    }
+    return dp;
+}
+
+/**
+ * Split the nodes [1, dp.size()) into `num_threads` contiguous ranges of
+ * about the same total cost dp[x]. The last range always ends at dp.size().
+ */
+template <typename Index>
+std::vector<std::pair<Index, Index>> partition_ranges(const std::vector<long> &dp, int num_threads) {
+    std::vector<std::pair<Index, Index>> ranges(num_threads);
+    const Index end = (Index)dp.size();
+
+    double total = 0;
+    for (Index x = 1; x < end; ++x) {
+        total += dp[x];
+    }
+
+    // Split the internal array to several subarray and assign to each thread
+    Index cur = 1;
+
+    for (int i = 0; i != num_threads; ++i) {
+        double average = total / (num_threads - i);
+        double thread_total = 0;
+        ranges[i].first = cur;
+        while (cur < end && thread_total < average) {
+            thread_total += dp[cur];
+            ++cur;
+        }
+
+        if (cur > ranges[i].first && labs(thread_total - average) > labs(thread_total - dp[cur - 1] - average) && cur > ranges[i].first + 1) {
+            --cur;
+            thread_total -= dp[cur];
+        }
+
+        ranges[i].second = cur;
+        total -= thread_total;
+    }
+
+    ranges.back().second = end;
+    return ranges;
+}
+
+// Shared state of the model-parallel trees: thread t only writes the nodes in [ranges[t].first, ranges[t].second)
+template <typename T, typename Index, typename Op>
+class FenwickTreeModelParallelBase : public FenwickTree<T, Index, Op> {
+  protected:
+    using Base = FenwickTree<T, Index, Op>;
+    using Base::bits;
+
+    using Base::op;
+
     int num_threads;
-    std::vector<int> bits;
-    std::vector<std::pair<int, int>> ranges;
-    std::vector<double> execution_times;
-    
-    void initialize_ranges(int n, int num_threads) {
-        std::vector<long> dp(n + 1);
-        double total = 0;
-        for (int x = 1; x <= n; ++x) {
-            ++dp[x];
-            total += dp[x];
+    std::vector<std::pair<Index, Index>> ranges;
+    Instrumentation stats;
+
+    // Per-thread partial results of batchSum()
+    std::vector<T> partial_sums;
+
+    // Sort-and-aggregate preprocessing of each batch, see aggregateBatch()
+    bool preprocess = false;
+    std::vector<std::pair<Index, T>> staged;
+    std::vector<std::pair<Index, T>> staged_swap;
+    std::vector<size_t> bucket_offsets;
+    std::vector<std::vector<std::vector<std::pair<Index, T>>>> outbox;
+
+    // The nodes are left unset until initialize_ranges() has every thread first-touch its own range
+    FenwickTreeModelParallelBase(Index n, int num_threads):
+        Base(n, Uninitialized()),
+        num_threads(num_threads),
+        ranges(num_threads),
+        stats(num_threads),
+        bucket_offsets(num_threads * num_threads + num_threads + 1),
+        outbox(num_threads, std::vector<std::vector<std::pair<Index, T>>>(num_threads)) {}
+
+    void initialize_ranges(const std::vector<long> &dp) {
+        ranges = partition_ranges<Index>(dp, num_threads);
+        alignRanges();
+        forEachRange([&](int t, Index lower, Index upper) {
+            Base::clearWithin(t == 0 ? 0 : lower, upper);
+        });
+    }
 
-            int next_x = x;
-            next_x += next_x & -next_x;
+    // Nodes per cache line, 1 if they do not tile it
+    static constexpr Index nodes_per_line = cache_line_size % sizeof(T) == 0 ? Index(cache_line_size / sizeof(T)) : 1;
+
+    /**
+     * Move the inner range boundaries to the nearest cache line start. The
+     * nodes start on a line, so no line is then written by two threads.
+     */
+    void alignRanges() {
+        for (int t = 1; t < num_threads; ++t) {
+            Index boundary = (ranges[t].first + nodes_per_line / 2) / nodes_per_line * nodes_per_line;
+            boundary = std::clamp(boundary, ranges[t - 1].first, ranges[t].second);
+            ranges[t - 1].second = ranges[t].first = boundary;
+        }
+    }
+
+    /**
+     * Run body(t, lower, upper) for range t on thread t of the team, pinned
+     * to its CPU. Writing a range here places its pages on the node of the
+     * thread that updates it in every batch. The batch regions pin thread t
+     * to the same CPU for their walks, so it cannot migrate off that node
+     * meanwhile. The threads get their own affinity back at the end of each
+     * region, so nothing else in the process inherits it.
+     */
+    template <typename Body>
+    void forEachRange(Body body) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            int t = omp_get_thread_num();
+            body(t, ranges[t].first, ranges[t].second);
+        }
+    }
+
+    // Index of the range containing the 1-based node `x`
+    int owner(Index x) const {
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), x,
+            [](Index value, const std::pair<Index, Index> &range) { return value < range.first; });
+        return int(it - ranges.begin()) - 1;
+    }
+
+    /**
+     * Preprocess the batch with the whole team before the per-thread walks:
+     * 1. Bucket the operations by the range owning their index (parallel
+     *    counting sort over the thread chunks of the batch).
+     * 2. Each thread radix sorts its own bucket by index and merges
+     *    duplicate indices into one delta.
+     * 3. Each distinct index is routed only to the ranges its update path
+     *    enters, as the entry node, so no thread scans operations that never
+     *    reach its range.
+     * Thread `t` then finds its work in outbox[0..t][t]. Must be called by
+     * every thread of the team. `Update` is Operation or any point update
+     * with `index` and `value` members.
+     */
+    template <typename Update>
+    void aggregateBatch(Span<const Update> operations, int t) {
+        const size_t m = operations.size();
+        const size_t chunk_begin = m * t / num_threads;
+        const size_t chunk_end = m * (t + 1) / num_threads;
+        const Index end = (Index)bits.size();
+
+        // counts[t][b] then, after the scan, the scatter offset of chunk t into bucket b
+        size_t *counts = &bucket_offsets[t * num_threads];
+        size_t *bucket_begin = &bucket_offsets[num_threads * num_threads];
+        std::fill(counts, counts + num_threads, 0);
+        for (size_t i = chunk_begin; i != chunk_end; ++i) {
+            Index x = operations[i].index + 1;
+            if (x < end) {
+                ++counts[owner(x)];
+            }
+        }
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            size_t offset = 0;
+            for (int b = 0; b != num_threads; ++b) {
+                bucket_begin[b] = offset;
+                for (int u = 0; u != num_threads; ++u) {
+                    size_t count = bucket_offsets[u * num_threads + b];
+                    bucket_offsets[u * num_threads + b] = offset;
+                    offset += count;
+                }
+            }
+            bucket_begin[num_threads] = offset;
+            staged.resize(offset);
+            staged_swap.resize(offset);
+        }
+
+        for (size_t i = chunk_begin; i != chunk_end; ++i) {
+            Index x = operations[i].index + 1;
+            if (x < end) {
+                staged[counts[owner(x)]++] = {x, (T)operations[i].value};
+            }
+        }
+
+        #pragma omp barrier
+
+        auto *first = staged.data() + bucket_begin[t];
+        auto *last = staged.data() + bucket_begin[t + 1];
+        const auto *sorted = radix_sort_by_key(first, last, staged_swap.data() + bucket_begin[t],
+                                               ranges[t].first, ranges[t].second);
+
+        auto *merged = first;
+        for (const auto *it = sorted; it != sorted + (last - first); ++it) {
+            if (merged != first && (merged - 1)->first == it->first) {
+                (merged - 1)->second = op((merged - 1)->second, it->second);
+            } else {
+                *merged++ = *it;
+            }
+        }
+
+        for (auto &out : outbox[t]) {
+            out.clear();
+        }
+        for (auto it = first; it != merged; ++it) {
+            auto [x, val] = *it;
+            int r = t;
+            while (true) {
+                outbox[t][r].emplace_back(x, val);
+                x = enter_range(x, ranges[r].second);
+                if (x >= end) {
+                    break;
+                }
+                while (ranges[r].second <= x) {
+                    ++r;
+                }
+            }
+        }
+
+        #pragma omp barrier
+    }
+
+    // Call f(entry node, value) for every operation of the batch whose update path enters [lower, upper) of thread t
+    template <typename Update, typename F>
+    void forEachEntry(Span<const Update> operations, int t, Index lower, Index upper, F &&f) {
+        if (preprocess) {
+            aggregateBatch(operations, t);
+            for (int src = 0; src <= t; ++src) {
+                for (const auto &[x, val] : outbox[src][t]) {
+                    f(x, val);
+                }
+            }
+            return;
+        }
+
+        for (const auto &operation : operations) {
+            Index x = enter_range<Index>(operation.index + 1, lower);
+            if (x < upper) {
+                f(x, (T)operation.value);
+            }
+        }
+    }
+
+    // Apply every operation of the batch to the nodes within [lower, upper) of thread t, returns the node writes if counted
+    template <typename Update, bool Count = false>
+    size_t walkBatch(Span<const Update> operations, int t, Index lower, Index upper,
+                     std::bool_constant<Count> = {}) {
+        size_t writes = 0;
+        forEachEntry(operations, t, lower, upper, [&](Index x, T val) {
+            for (; x < upper; x += x & -x) {
+                bits[x] = op(bits[x], val);
+                if constexpr (Count) {
+                    ++writes;
+                }
+            }
+        });
+        return writes;
+    }
+
+  public:
+    // Parallel linear-time construction, each thread building its own range
+    void build(const T *values, size_t n) {
+        Base::buildRanges(values, n, ranges);
+    }
+
+    // Model-parallel batchSum(): each thread combines the nodes of its own range, then the partials are reduced
+    void batchSum(const Index *idx, T *out, size_t k) {
+        partial_sums.resize(k * num_threads);
+
+        #pragma omp parallel
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            int t = omp_get_thread_num();
+            const auto [lower, upper] = ranges[t];
+
+            T *local = &partial_sums[k * t];
+            for (size_t i = 0; i != k; ++i) {
+                local[i] = Base::sumWithin(idx[i] + 1, lower, upper);
+            }
+
+            #pragma omp barrier
+            #pragma omp for
+            for (size_t i = 0; i < k; ++i) {
+                T total = Op::identity();
+                for (int u = 0; u != num_threads; ++u) {
+                    total = op(total, partial_sums[k * u + i]);
+                }
+                out[i] = total;
+            }
+        }
+    }
+
+    // Enable the sort-and-aggregate preprocessing stage of batchAdd
+    void setPreprocess(bool enable) {
+        preprocess = enable;
+    }
+
+    // The nodes and the node ranges of the threads
+    SnapshotView snapshot() const {
+        SnapshotView view = Base::snapshot();
+        view.setRanges(ranges);
+        return view;
+    }
+
+    /**
+     * Restore the nodes, and the ranges too if the snapshot was taken with
+     * as many threads. Every thread copies its own range, so the pages stay
+     * on its NUMA node. Returns false for a snapshot of another tree.
+     */
+    bool restore(const MappedSnapshot &snapshot) {
+        const T *nodes = snapshot.numArrays() == 1 ? snapshot.array<T>(0, bits.size()) : nullptr;
+        if (!nodes) {
+            return false;
+        }
+
+        bool same_partition = snapshot.numRanges() == (size_t)num_threads
+            && snapshot.range(0).first == 1 && snapshot.range(num_threads - 1).second == (long long)bits.size();
+        for (int t = 0; same_partition && t != num_threads; ++t) {
+            const auto [lower, upper] = snapshot.range(t);
+            same_partition = lower <= upper && (t == 0 || lower == snapshot.range(t - 1).second);
+        }
+        if (same_partition) {
+            for (int t = 0; t != num_threads; ++t) {
+                ranges[t] = {(Index)snapshot.range(t).first, (Index)snapshot.range(t).second};
+            }
         }
 
-        // Split the internal array to several subarray and assign to each thread
-        int cur = 1;
+        forEachRange([&](int t, Index lower, Index upper) {
+            const Index first = t == 0 ? 0 : lower;
+            std::copy(nodes + first, nodes + upper, bits.begin() + first);
+        });
+        return true;
+    }
 
+    void printRanges() {
         for (int i = 0; i != num_threads; ++i) {
-            double average = total / (num_threads - i);
-            double thread_total = 0;
-            ranges[i].first = cur;
-            while (cur < (int)bits.size() && thread_total < average) {
-                thread_total += dp[cur];
-                ++cur;
+            std::cerr << "Thread " << i << ' ' << ranges[i].first << ' ' << ranges[i].second << '\n';
+        }
+    }
+
+    // Per-thread busy time, barrier wait and node writes of every batchAdd from now on
+    void setInstrumentation(bool enable) {
+        stats.enable(enable);
+    }
+
+    const Instrumentation &instrumentation() const {
+        return stats;
+    }
+
+    void statistics(std::ostream &out = std::cerr) const {
+        stats.writeJson(out, ranges);
+    }
+};
+
+// Model-Parallel Fenwick Tree - Fixed Size
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeModelParallel : public FenwickTreeModelParallelBase<T, Index, Op> {
+  private:
+    using Base = FenwickTreeModelParallelBase<T, Index, Op>;
+    using Base::ranges;
+    using Base::stats;
+
+  public:
+    FenwickTreeModelParallel(Index n, int num_threads) : Base(n, num_threads) {
+        Base::initialize_ranges(uniform_cost(n));
+    }
+
+    void batchAdd(Span<const Operation> operations) {
+        #pragma omp parallel
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            int t = omp_get_thread_num();
+            const auto [lower, upper] = ranges[t];
+
+            // [lower, upper)
+            instrumented_batch(stats, t, [&](bool count) {
+                return count ? Base::walkBatch(operations, t, lower, upper, std::true_type())
+                             : Base::walkBatch(operations, t, lower, upper);
+            });
+        }
+    }
+};
+
+// Model-Parallel Fenwick Tree - Access Aware
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeModelParallelAccessAware : public FenwickTreeModelParallelBase<T, Index, Op> {
+  private:
+    using Base = FenwickTreeModelParallelBase<T, Index, Op>;
+    using Base::ranges;
+    using Base::stats;
+
+  public:
+    FenwickTreeModelParallelAccessAware(Index n, int num_threads) : Base(n, num_threads) {
+        Base::initialize_ranges(access_cost(n));
+    }
+
+    void batchAdd(Span<const Operation> operations) {
+        #pragma omp parallel
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            int t = omp_get_thread_num();
+            const auto [lower, upper] = ranges[t];
+
+            // [lower, upper)
+            instrumented_batch(stats, t, [&](bool count) {
+                return count ? Base::walkBatch(operations, t, lower, upper, std::true_type())
+                             : Base::walkBatch(operations, t, lower, upper);
+            });
+        }
+    }
+};
+
+/**
+ * Model-Parallel Fenwick Tree - Semi-Static: the ranges are rebalanced
+ * between batches from what the previous batches actually cost.
+ * - The update indices are counted per bucket of 2^shift nodes, decayed by
+ *   half every batch. A bucket costs its updates times the average path
+ *   length inside it, plus the writes of its top node (a multiple of
+ *   2^shift), which are the updates in (x - lowbit(x), x]: a difference of
+ *   the prefix of the histogram.
+ * - The measured time of each thread divided by the modelled cost of its
+ *   range gives a per-bucket rate correction for what the write count does
+ *   not capture, e.g. cache misses on the large top-level strides.
+ * The new boundaries are computed serially after the parallel region, so no
+ * thread ever reads ranges while they move, and only adopted when the
+ * predicted imbalance of the current ranges exceeds `tolerance`.
+ */
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeModelParallelSemiStatic : public FenwickTreeModelParallelBase<T, Index, Op> {
+  private:
+    using Base = FenwickTreeModelParallelBase<T, Index, Op>;
+    using Base::bits;
+    using Base::ranges;
+    using Base::stats;
+    using Base::num_threads;
+
+    int shift = 0;
+    Index num_buckets = 0;
+    double tolerance;
+
+    // bucket_counts[t][k]: updates of this batch counted by thread t in bucket k (1-based)
+    std::vector<std::vector<unsigned>> bucket_counts;
+    std::vector<double> histogram;
+    std::vector<double> rates;
+    std::vector<double> thread_times;
+    bool observed = false;
+    bool time_feedback;
+
+    // 1-based bucket of the 1-based node x
+    Index bucket(Index x) const {
+        return ((x - 1) >> shift) + 1;
+    }
+
+    Index bucketBegin(Index k) const {
+        return std::min<Index>(((k - 1) << shift) + 1, (Index)bits.size());
+    }
+
+    // Modelled writes per bucket for the given per-bucket update counts
+    std::vector<double> bucketCosts(const std::vector<double> &updates) const {
+        const double low_steps = shift / 2.0;
+        const Index n = (Index)bits.size() - 1;
+
+        std::vector<double> prefix(num_buckets + 1);
+        for (Index k = 1; k <= num_buckets; ++k) {
+            prefix[k] = prefix[k - 1] + updates[k];
+        }
+
+        std::vector<double> costs(num_buckets + 1);
+        for (Index k = 1; k <= num_buckets; ++k) {
+            costs[k] = updates[k] * low_steps;
+            if (((long long)k << shift) <= n) {
+                costs[k] += prefix[k] - prefix[k - (k & -k)];
+            }
+        }
+        return costs;
+    }
+
+    void repartition() {
+        std::vector<double> updates(num_buckets + 1);
+        for (auto &counts : bucket_counts) {
+            for (Index k = 1; k <= num_buckets; ++k) {
+                updates[k] += counts[k];
+                counts[k] = 0;
+            }
+        }
+
+        // Rate correction from the measured time over the modelled cost of each thread
+        const auto costs = bucketCosts(updates);
+        std::vector<double> thread_costs(num_threads);
+        for (Index k = 1, t = 0; k <= num_buckets; ++k) {
+            while (t + 1 < num_threads && bucketBegin(k) >= ranges[t].second) {
+                ++t;
+            }
+            thread_costs[t] += costs[k];
+        }
+
+        double mean_rate = 0;
+        int measured = 0;
+        for (int t = 0; t != num_threads; ++t) {
+            if (thread_costs[t] > 0) {
+                mean_rate += thread_times[t] / thread_costs[t];
+                ++measured;
+            }
+        }
+        if (time_feedback && measured > 0 && mean_rate > 0) {
+            mean_rate /= measured;
+            for (Index k = 1, t = 0; k <= num_buckets; ++k) {
+                while (t + 1 < num_threads && bucketBegin(k) >= ranges[t].second) {
+                    ++t;
+                }
+                if (thread_costs[t] > 0) {
+                    rates[k] = 0.5 * rates[k] + 0.5 * (thread_times[t] / thread_costs[t]) / mean_rate;
+                }
             }
+        }
+
+        for (Index k = 1; k <= num_buckets; ++k) {
+            histogram[k] = observed ? 0.5 * (histogram[k] + updates[k]) : updates[k];
+        }
+        observed = true;
 
-            if (cur > ranges[i].first && labs(thread_total - average) > labs(thread_total - dp[cur - 1] - average) && cur > ranges[i].first + 1) {
-                --cur;
-                thread_total -= dp[cur];
+        // Predicted cost of the current ranges under the updated model
+        const auto model = bucketCosts(histogram);
+        std::vector<long> dp(num_buckets + 1);
+        std::vector<double> predicted(num_threads);
+        double total = 0;
+        for (Index k = 1, t = 0; k <= num_buckets; ++k) {
+            while (t + 1 < num_threads && bucketBegin(k) >= ranges[t].second) {
+                ++t;
             }
+            double cost = model[k] * rates[k];
+            dp[k] = std::lround(cost * 256);
+            predicted[t] += cost;
+            total += cost;
+        }
 
-            ranges[i].second = cur;
-            total -= thread_total;
+        double max_cost = *std::max_element(predicted.begin(), predicted.end());
+        if (total <= 0 || max_cost * num_threads <= tolerance * total) {
+            return;
         }
 
-        ranges.back().second = bits.size();
+        const auto bucket_ranges = partition_ranges<Index>(dp, num_threads);
+        for (int t = 0; t != num_threads; ++t) {
+            ranges[t] = {bucketBegin(bucket_ranges[t].first), bucketBegin(bucket_ranges[t].second)};
+        }
+        ranges.back().second = (Index)bits.size();
+        Base::alignRanges();
     }
 
   public:
-    FenwickTreeModelParallel(int n, int num_threads):
-        num_threads(num_threads),
-        bits(n + 1, 0), 
-        ranges(num_threads), 
-        execution_times(num_threads) {
-        initialize_ranges(n, num_threads);
-    }
-
-    void add(int x, int val) override {
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x] += val;
+    FenwickTreeModelParallelSemiStatic(Index n, int num_threads, double tolerance = 1.05):
+        Base(n, num_threads),
+        tolerance(tolerance),
+        bucket_counts(num_threads),
+        thread_times(num_threads),
+        // Per-thread times only measure a thread's own work if it has a core to itself
+        time_feedback(num_threads <= omp_get_num_procs()) {
+        Base::initialize_ranges(access_cost(n));
+
+        // About 64 buckets per thread, at least 1024, so the boundaries can move finely
+        const long long target = std::max(1024LL, 64LL * num_threads);
+        while (((long long)n >> shift) > target) {
+            ++shift;
         }
-    }
+        num_buckets = n > 0 ? bucket(n) : 0;
 
-    int sum(int x) override {
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
+        for (auto &counts : bucket_counts) {
+            counts.assign(num_buckets + 1, 0);
         }
-        return total;
+        histogram.assign(num_buckets + 1, 0);
+        rates.assign(num_buckets + 1, 1.0);
     }
 
-    void batchAdd(std::vector<Operation> &operations) {
+    void batchAdd(Span<const Operation> operations) {
         #pragma omp parallel
         {
+            ScopedPin pin(openmp_thread_cpu());
             int t = omp_get_thread_num();
             const auto [lower, upper] = ranges[t];
 
-            #ifdef TIMING
-            auto start_time = omp_get_wtime();
-            #endif
-
-            for (const auto &operation : operations) {
-                int x = operation.index + 1;
-                int val = operation.value;
-
-                /** 
-                 * Compute the smallest index derived from `x` that lies 
-                 * within the target range.
-                 *    
-                 * This avoids having each thread start from the original
-                 * `x` and loop through unnecessarily to locate their valid
-                 * range.
-                 */
-                if (x < lower) {
-                    auto highest_diff_bit 
-                        = 0x8000000000000000ULL >> __builtin_clzll(x ^ lower);
-
-                    x |= highest_diff_bit;
-                    x &= ~(highest_diff_bit - 1);
-
-                    if (x < lower) {
-                        x += x & -x;
-                    }
-                }
-
-                // [lower, upper)
-                for (; x < upper; x += x & -x) {
-                    bits[x] += val;
+            // Add a barrier for more accurate estimation of execution time
+            #pragma omp barrier
+            double start_time = omp_get_wtime();
+
+            // Each thread deal with the range: [lower, upper)
+            instrumented_batch(stats, t, [&](bool count) {
+                return count ? Base::walkBatch(operations, t, lower, upper, std::true_type())
+                             : Base::walkBatch(operations, t, lower, upper);
+            });
+
+            thread_times[t] = omp_get_wtime() - start_time;
+
+            // Access histogram of this thread's chunk of the batch
+            auto &counts = bucket_counts[t];
+            const size_t m = operations.size();
+            for (size_t i = m * t / num_threads; i != m * (t + 1) / num_threads; ++i) {
+                Index x = operations[i].index + 1;
+                if (x < (Index)bits.size()) {
+                    ++counts[bucket(x)];
                 }
             }
-
-            #ifdef TIMING
-            auto end_time = omp_get_wtime();
-            execution_times[t] += end_time - start_time;
-            #endif
-        }
-    }
-
-    void printRanges() {
-        for (int i = 0; i != num_threads; ++i) {
-            std::cerr << "Thread " << i << ' ' << ranges[i].first << ' ' << ranges[i].second << '\n';
         }
-    }
 
-    void statistics() {
-        for (auto time : execution_times) {
-            std::cerr << time << '\n';
+        // Serial between batches: no thread is reading ranges
+        if (num_buckets > 0) {
+            repartition();
         }
     }
 };
 
-// Model-Parallel Fenwick Tree - Access Aware
-class FenwickTreeModelParallelAccessAware : public FenwickTreeBase {
+/**
+ * Model-Parallel Fenwick Tree - Aggregate: each thread combines the batch
+ * into per-node deltas of its range and folds them up the range once, so
+ * every node is written once per batch. The fold costs the whole range
+ * however few nodes changed, so batches of fewer than `dense_density` * n
+ * updates walk their in-range paths directly instead, as the
+ * access-aware tree does. The full-size delta array is only allocated, and
+ * first-touched, by the first dense batch, so a tree that only sees sparse
+ * batches costs no more memory than the others.
+ */
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeModelParallelAggregate : public FenwickTreeModelParallelBase<T, Index, Op> {
   private:
-    int num_threads;
-    std::vector<int> bits;
-    std::vector<std::pair<int, int>> ranges;
-    std::vector<double> execution_times;
-    
-    void initialize_ranges(int n, int num_threads) {
-        std::vector<long> dp(n + 1);
-        double total = 0;
-        for (int x = 1; x <= n; ++x) {
-            ++dp[x];
-            total += dp[x];
-
-            int next_x = x;
-            next_x += next_x & -next_x;
-            if (next_x <= n) {
-                dp[next_x] += dp[x];
-            }
+    using Base = FenwickTreeModelParallelBase<T, Index, Op>;
+    using Base::bits;
+    using Base::op;
+    using Base::ranges;
+    using Base::stats;
+
+    std::vector<T, TreeAllocator<T>> local_bits;
+    bool local_bits_ready = false;
+    size_t dense_batches = 0;
+    double dense_density = 1.0 / 32; // about where the fold overtakes the walks at 1M and 16M nodes
+
+    // Vectorized fold of int sums, see fold_kernels.h
+    static constexpr bool has_fold_kernel = std::is_same_v<T, int> && std::is_same_v<Op, Plus<int>>;
+    FoldKernel fold_kernel = find_fold_kernel("auto");
+
+    size_t foldDense(Span<const Operation> operations, int t, Index lower, Index upper) {
+        if (!local_bits_ready) {
+            std::fill(local_bits.begin() + (t == 0 ? 0 : lower), local_bits.begin() + upper, Op::identity());
         }
-
-        // Split the internal array to several subarray and assign to each thread
-        int cur = 1;
-
-        for (int i = 0; i != num_threads; ++i) {
-            double average = total / (num_threads - i);
-            double thread_total = 0;
-            ranges[i].first = cur;
-            while (cur < (int)bits.size() && thread_total < average) {
-                thread_total += dp[cur];
-                ++cur;
-            }
-
-            if (cur > ranges[i].first && labs(thread_total - average) > labs(thread_total - dp[cur - 1] - average) && cur > ranges[i].first + 1) {
-                --cur;
-                thread_total -= dp[cur];
+        Base::forEachEntry(operations, t, lower, upper, [&](Index x, T val) {
+            local_bits[x] = op(local_bits[x], val);
+        });
+
+        if constexpr (has_fold_kernel) {
+            fold_kernel(bits.data(), local_bits.data(), lower, upper);
+        } else {
+            for (Index x = lower; x < upper; ++x) {
+                Index next_x = x;
+                next_x += x & -x;
+                T val_agg = local_bits[x];
+                if (next_x < upper) {
+                    local_bits[next_x] = op(local_bits[next_x], val_agg);
+                }
+                bits[x] = op(bits[x], val_agg);
+                local_bits[x] = Op::identity();
             }
-
-            ranges[i].second = cur;
-            total -= thread_total;
         }
 
-        ranges.back().second = bits.size();
+        // The fold writes every node of the range once
+        return size_t(upper - lower);
     }
 
   public:
-    FenwickTreeModelParallelAccessAware(int n, int num_threads):
-        num_threads(num_threads),
-        bits(n + 1, 0), 
-        ranges(num_threads), 
-        execution_times(num_threads) {
-        initialize_ranges(n, num_threads);
+    FenwickTreeModelParallelAggregate(Index n, int num_threads):
+        Base(n, num_threads) {
+        Base::initialize_ranges(uniform_cost(n));
     }
 
-    void add(int x, int val) override {
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x] += val;
+    // scalar, avx2, avx512 or auto; false if the CPU lacks it or the tree does not fold int sums
+    bool setFoldKernel(const std::string &name) {
+        if (!has_fold_kernel) {
+            return name == "scalar" || name == "auto";
         }
+        FoldKernel kernel = find_fold_kernel(name);
+        if (kernel) {
+            fold_kernel = kernel;
+        }
+        return kernel != nullptr;
     }
 
-    int sum(int x) override {
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
-        }
-        return total;
+    // Batches of at least `density` * n updates take the dense fold: 0 always, infinity never
+    void setDenseDensity(double density) {
+        dense_density = density;
+    }
+
+    // Batches that took the dense fold so far
+    size_t denseBatches() const {
+        return dense_batches;
     }
 
-    void batchAdd(std::vector<Operation> &operations) {
+    void batchAdd(Span<const Operation> operations) {
+        const bool dense = operations.size() >= dense_density * Base::size();
+        if (dense && local_bits.empty()) {
+            local_bits.resize(bits.size());
+        }
+
         #pragma omp parallel
         {
+            ScopedPin pin(openmp_thread_cpu());
             int t = omp_get_thread_num();
             const auto [lower, upper] = ranges[t];
 
-            #ifdef TIMING
-            auto start_time = omp_get_wtime();
-            #endif
-
-            for (const auto &operation : operations) {
-                int x = operation.index + 1;
-                int val = operation.value;
-
-                /** 
-                 * Compute the smallest index derived from `x` that lies 
-                 * within the target range.
-                 *    
-                 * This avoids having each thread start from the original
-                 * `x` and loop through unnecessarily to locate their valid
-                 * range.
-                 */
-                if (x < lower) {
-                    auto highest_diff_bit 
-                        = 0x8000000000000000ULL >> __builtin_clzll(x ^ lower);
-
-                    x |= highest_diff_bit;
-                    x &= ~(highest_diff_bit - 1);
-
-                    if (x < lower) {
-                        x += x & -x;
-                    }
+            instrumented_batch(stats, t, [&](bool count) {
+                if (dense) {
+                    return foldDense(operations, t, lower, upper);
                 }
+                return count ? Base::walkBatch(operations, t, lower, upper, std::true_type())
+                             : Base::walkBatch(operations, t, lower, upper);
+            });
+        }
+        local_bits_ready |= dense;
+        dense_batches += dense;
+    }
+};
 
-                // [lower, upper)
-                for (; x < upper; x += x & -x) {
-                    bits[x] += val;
-                }
-            }
+/**
+ * Readers that never wait for a batch: two copies of any tree with
+ * batchAdd() and sum(). Queries read the published copy, which always
+ * holds the state after the last whole batch, while batchAdd() applies
+ * the next batch to the other one, publishes it, waits until the readers
+ * still inside the old copy have left and applies the batch there too. A
+ * reader registers with the copy it read as published and checks that
+ * it still is; the registration and the check race only with a publish,
+ * so sum() retries at most once per batch and never waits for one.
+ * Writes cost twice as much and the tree twice the memory. One writer.
+ */
+template <typename Tree>
+class FenwickTreeVersioned {
+  public:
+    using value_type = typename Tree::value_type;
+    using index_type = typename Tree::index_type;
+
+  private:
+    struct alignas(64) ReaderCount {
+        std::atomic<long> count{0};
+    };
 
-            #ifdef TIMING
-            auto end_time = omp_get_wtime();
-            execution_times[t] += end_time - start_time;
-            #endif
+    Tree versions[2];
+    mutable ReaderCount readers[2];
+    alignas(64) std::atomic<int> published{0};
+    std::atomic<unsigned long long> committed{0};
+
+  public:
+    template <typename... Args>
+    explicit FenwickTreeVersioned(const Args &...args) : versions{Tree(args...), Tree(args...)} {}
+
+    // Sum over [0, x] after the last whole batch
+    value_type sum(index_type x) const {
+        int v;
+        while (true) {
+            v = published.load();
+            readers[v].count.fetch_add(1);
+            if (published.load() == v) {
+                break;
+            }
+            readers[v].count.fetch_sub(1, std::memory_order_release);
         }
+        value_type total = versions[v].sum(x);
+        readers[v].count.fetch_sub(1, std::memory_order_release);
+        return total;
     }
 
-    void printRanges() {
-        for (int i = 0; i != num_threads; ++i) {
-            std::cerr << "Thread " << i << ' ' << ranges[i].first << ' ' << ranges[i].second << '\n';
-        }
+    // Batches committed so far, a reader's sum() reflects at least this many
+    unsigned long long version() const {
+        return committed.load(std::memory_order_acquire);
     }
 
-    void statistics() {
-        for (auto time : execution_times) {
-            std::cerr << time << '\n';
+    void batchAdd(Span<const Operation> operations) {
+        const int front = published.load(std::memory_order_relaxed);
+        versions[1 - front].batchAdd(operations);
+        published.store(1 - front);
+        committed.fetch_add(1, std::memory_order_release);
+
+        while (readers[front].count.load()) {
+            std::this_thread::yield();
         }
+        versions[front].batchAdd(operations);
+    }
+
+    // The copy the readers are served from, e.g. for its instrumentation; never write to it
+    const Tree &current() const {
+        return versions[published.load()];
+    }
+
+    // Configure both copies alike, e.g. [](auto &tree) { tree.setPreprocess(true); }
+    template <typename Body>
+    void forEachVersion(Body body) {
+        body(versions[0]);
+        body(versions[1]);
     }
 };
 
-// Model-Parallel Fenwick Tree
-class FenwickTreeModelParallelSemiStatic : FenwickTreeBase {
+// Lazy Sync Fenwick Tree
+// Current Imp: Less fine-grained: stop the world when read;
+// Can try but expect less perf
+// => More fine-grained: read/write sets => but might have huge cache coherency traffic
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeLSync {
+  public:
+    using value_type = T;
+    using index_type = Index;
+    using op_type = Op;
+
   private:
-    int num_threads;
-    std::vector<int> bits;
-    std::vector<std::pair<int, int>> ranges;
-    std::vector<double> execution_times;
-    
-    // should be an odd number
-    const int step = 127;
-
-    void initialize_ranges(int n, int num_threads) {
-        std::vector<long> dp(n + 1);
-        double total = 0;
-        for (int x = 1; x <= n; ++x) {
-            ++dp[x];
-            total += dp[x];
+    std::vector<std::atomic<T>, TreeAllocator<std::atomic<T>>> bits;
+    Op op;
 
-            int next_x = x;
-            next_x += next_x & -next_x;
-            if (next_x <= n) {
-                dp[next_x] += dp[x];
+  public:
+    // The team first-touches its static shares of the nodes, spreading their pages over the nodes of its CPUs
+    FenwickTreeLSync(Index n) : bits(n + 1) {
+        #pragma omp parallel
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            #pragma omp for schedule(static)
+            for (size_t x = 0; x < bits.size(); ++x) {
+                bits[x].store(Op::identity(), std::memory_order_relaxed);
             }
         }
+    }
 
-        // Split the internal array to several subarray and assign to each thread
-        int cur = 1;
-
-        for (int i = 0; i != num_threads; ++i) {
-            double average = total / (num_threads - i);
-            double thread_total = 0;
-            ranges[i].first = cur;
-            while (cur < (int)bits.size() && thread_total < average) {
-                thread_total += dp[cur];
-                ++cur;
-            }
-
-            if (cur > ranges[i].first && labs(thread_total - average) > labs(thread_total - dp[cur - 1] - average) && cur > ranges[i].first + 1) {
-                --cur;
-                thread_total -= dp[cur];
-            }
+    // Linear-time construction; not safe against concurrent add or sum
+    void build(const T *values, size_t n) {
+        FenwickTree<T, Index, Op> staging((Index)bits.size() - 1);
+        staging.buildParallel(values, n);
+        const T *nodes = staging.data();
 
-            ranges[i].second = cur;
-            total -= thread_total;
+        #pragma omp parallel for
+        for (size_t x = 0; x < bits.size(); ++x) {
+            bits[x].store(nodes[x], std::memory_order_relaxed);
         }
-
-        ranges.back().second = bits.size();
     }
 
-  public:
-    FenwickTreeModelParallelSemiStatic(int n, int num_threads, int step = 127):
-        num_threads(num_threads),
-        bits(n + 1, 0), 
-        ranges(num_threads), 
-        execution_times(num_threads),
-        step((step & ~1) + 1) {
-        initialize_ranges(n, num_threads);
+    // Not ordered against a concurrent add; exact between batches
+    SnapshotView snapshot() const {
+        static_assert(sizeof(std::atomic<T>) == sizeof(T), "snapshots store the atomics as plain nodes");
+        SnapshotView view;
+        view.add(reinterpret_cast<const T *>(bits.data()), bits.size());
+        return view;
     }
 
-    void add(int x, int val) override {
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x] += val;
-        }
+    bool restore(const MappedSnapshot &snapshot) {
+        return snapshot.numArrays() == 1 && restoreArray(snapshot, 0);
     }
 
-    int sum(int x) override {
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
+    // Restore from array `array` of a snapshot of several trees
+    bool restoreArray(const MappedSnapshot &snapshot, unsigned array) {
+        const T *nodes = snapshot.array<T>(array, bits.size());
+        if (!nodes) {
+            return false;
         }
-        return total;
+        #pragma omp parallel for
+        for (size_t x = 0; x < bits.size(); ++x) {
+            bits[x].store(nodes[x], std::memory_order_relaxed);
+        }
+        return true;
     }
 
-    void batchAdd(std::vector<Operation> &operations) {
-        #pragma omp parallel
-        {
-            int t = omp_get_thread_num();
-            const auto [lower, upper] = ranges[t];
-
-            // Add a barrier for more accurate estimation of execution time
-            #pragma omp barrier
-            #ifdef TIMING
-            auto start_time = omp_get_wtime();
-            #endif
-            for (const auto &operation : operations) {
-                int x = operation.index + 1;
-                int val = operation.value;
-
-                /** 
-                 * Compute the smallest index derived from `x` that lies 
-                 * within the target range.
-                 *    
-                 * This avoids having each thread start from the original
-                 * `x` and loop through unnecessarily to locate their valid
-                 * range.
-                 */
-                if (x < lower) {
-                    auto highest_diff_bit 
-                        = 0x8000000000000000ULL >> __builtin_clzll(x ^ lower);
-
-                    x |= highest_diff_bit;
-                    x &= ~(highest_diff_bit - 1);
-
-                    if (x < lower) {
-                        x += x & -x;
-                    }
-                }
-
-                // Each thread deal with the range: [lower, upper)
-                for (; x < upper; x += x & -x) {
-                    bits[x] += val;
-                }
-            }
-
-            #ifdef TIMING
-            auto end_time = omp_get_wtime();
-            execution_times[t] += end_time - start_time;
-            #endif
-            
-            // Semi-static scheduling: adjust ranges based on the execution results
-            #pragma omp single nowait
-            {
-                if (ranges[t].first == 1) {
-                    if (ranges[t].second + step < (int)bits.size()) {
-                        ranges[t].second += step;
-                        ranges[t+1].first += step;
-                    }
-                } else if (ranges[t].second == (int)bits.size()) {
-                    if (ranges[t].first - step >= 1) {
-                        ranges[t].first -= step;
-                        ranges[t-1].second -= step;
-                    }
-                } else {
-                    int b = (ranges[t].first + ranges[t].second) & 1;
-                    if (b == 0 && ranges[t].first - step >= 1) {
-                        ranges[t].first -= step;
-                        ranges[t-1].second -= step;
-                    } else if (ranges[t].second + step < (int)bits.size()) {
-                        ranges[t].second += step;
-                        ranges[t+1].first += step;
-                    }
-                }
-            }
+    // Thread-safe add operation with atomic nodes
+    void add(Index x, T val) {
+        for (++x; x < (Index)bits.size(); x += x & -x) {
+            atomic_combine(bits[x], val, op);
         }
     }
 
-    void printRanges() {
-        for (int i = 0; i != num_threads; ++i) {
-            std::cerr << "Thread " << i << ' ' << ranges[i].first << ' ' << ranges[i].second << '\n';
+    // Thread-safe sum operation (no locks needed with only 1 reader at a time)
+    T sum(Index x) const {
+        T total = Op::identity();
+        for (++x; x > 0; x -= x & -x) {
+            total = op(total, bits[x].load());
         }
+        return total;
     }
 
-    void statistics() {
-        for (auto time : execution_times) {
-            std::cerr << time << '\n';
+    // Answer a run of queries with no add in between in parallel
+    void batchSum(const Index *idx, T *out, size_t k) const {
+        #pragma omp parallel for if (k >= 64)
+        for (size_t i = 0; i < k; ++i) {
+            out[i] = sum(idx[i]);
         }
     }
 };
 
-// Model-Parallel Fenwick Tree
-class FenwickTreeModelParallelAggregate : FenwickTreeBase {
+/**
+ * Lazy Sync Fenwick Tree with per-thread combining of the hot top levels.
+ * The nodes of the top `combine_levels` levels (multiples of 2^shift) are on
+ * almost every update path, so direct atomics on them ping-pong their cache
+ * lines between all cores. batchAdd() walks the low levels with relaxed
+ * atomics and stops at the first hot node, accumulating the rest in a small
+ * per-thread buffer. The hot nodes of a buffer form a Fenwick tree of their
+ * own, so it is folded once per batch and each hot node receives at most one
+ * atomic per thread. Batches too small to amortize the flush fall back to
+ * direct atomics.
+ */
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeLCombine {
+  public:
+    using value_type = T;
+    using index_type = Index;
+    using op_type = Op;
+
   private:
+    std::vector<std::atomic<T>, TreeAllocator<std::atomic<T>>> bits;
+    Op op;
+
     int num_threads;
-    std::vector<int> bits;
-    std::vector<int> local_bits;
-    std::vector<std::pair<int, int>> ranges;
-    std::vector<double> execution_times;
-    
-    void initialize_ranges(int n, int num_threads) {
-        std::vector<long> dp(n + 1);
-        double total = 0;
-        for (int x = 1; x <= n; ++x) {
-            ++dp[x];
-            total += dp[x];
+    int combine_levels = 0;
+    int shift = 0;
+    Index num_hot = 0;
 
-            int next_x = x;
-            next_x += next_x & -next_x;
-        }
+    // buffers[t][i] holds the pending delta of hot node i << shift for thread t
+    std::vector<std::vector<T>> buffers;
+    std::vector<std::vector<char>> dirty;
 
-        // Split the internal array to several subarray and assign to each thread
-        double average = total / num_threads;
-        int cur = 1;
+    void addDirect(Index x, T val) {
+        for (; x < (Index)bits.size(); x += x & -x) {
+            atomic_combine(bits[x], val, op, std::memory_order_relaxed);
+        }
+    }
 
-        for (int i = 0; i != num_threads; ++i) {
-            double thread_total = 0;
-            ranges[i].first = cur;
-            while (cur < (int)bits.size() && thread_total < average) {
-                thread_total += dp[cur];
-                ++cur;
+    void flush(int t) {
+        auto &buffer = buffers[t];
+        auto &touched = dirty[t];
+        for (Index i = 1; i <= num_hot; ++i) {
+            if (!touched[i]) {
+                continue;
             }
-
-            if (cur > ranges[i].first && labs(thread_total - average) > labs(thread_total - dp[cur - 1] - average)) {
-                --cur;
-                thread_total -= dp[cur];
+            Index parent = i + (i & -i);
+            if (parent <= num_hot) {
+                buffer[parent] = op(buffer[parent], buffer[i]);
+                touched[parent] = 1;
             }
-
-            ranges[i].second = cur;
+            atomic_combine(bits[(size_t)i << shift], buffer[i], op, std::memory_order_relaxed);
+            buffer[i] = Op::identity();
+            touched[i] = 0;
         }
-
-        ranges.back().second = bits.size();
     }
 
   public:
-    FenwickTreeModelParallelAggregate(int n, int num_threads):
+    FenwickTreeLCombine(Index n, int num_threads, int combine_levels = 8) :
+        bits(n + 1),
         num_threads(num_threads),
-        bits(n + 1, 0), 
-        local_bits(n + 1, 0),
-        ranges(num_threads), 
-        execution_times(num_threads) {
-        initialize_ranges(n, num_threads);
-    }
-
-    void add(int x, int val) override {
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x] += val;
+        buffers(num_threads),
+        dirty(num_threads) {
+        // First-touched by the team in static shares, as in FenwickTreeLSync
+        #pragma omp parallel num_threads(num_threads)
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            #pragma omp for schedule(static)
+            for (size_t x = 0; x < bits.size(); ++x) {
+                bits[x].store(Op::identity(), std::memory_order_relaxed);
+            }
         }
+        setCombineLevels(combine_levels);
     }
 
-    int sum(int x) override {
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
-        }
-        return total;
-    }
+    // Buffer the top `levels` levels per thread; 0 makes batchAdd use direct relaxed atomics only
+    void setCombineLevels(int levels) {
+        const Index n = (Index)bits.size() - 1;
+        const int height = n > 0 ? 64 - __builtin_clzll((unsigned long long)n) : 0;
 
-    void batchAdd(std::vector<Operation> &operations) {
-        #pragma omp parallel
-        {
-            int t = omp_get_thread_num();
-            const auto [lower, upper] = ranges[t];
+        combine_levels = std::clamp(levels, 0, height);
+        shift = height - combine_levels;
+        num_hot = combine_levels > 0 ? (n >> shift) : 0;
 
-            #ifdef TIMING
-            auto start_time = omp_get_wtime();
-            #endif
-            for (const auto &operation : operations) {
-                int x = operation.index + 1;
-                int val = operation.value;
-
-                /** 
-                 * Compute the smallest index derived from `x` that lies 
-                 * within the target range.
-                 *    
-                 * This avoids having each thread start from the original
-                 * `x` and loop through unnecessarily to locate their valid
-                 * range.
-                 */
-                if (x < lower) {
-                    auto highest_diff_bit 
-                        = 0x8000000000000000ULL >> __builtin_clzll(x ^ lower);
-
-                    x |= highest_diff_bit;
-                    x &= ~(highest_diff_bit - 1);
-
-                    if (x < lower) {
-                        x += x & -x;
-                    }
-                }
+        for (int t = 0; t != num_threads; ++t) {
+            buffers[t].assign(num_hot + 1, Op::identity());
+            dirty[t].assign(num_hot + 1, 0);
+        }
+    }
 
-                if (x < upper) {
-                    local_bits[x] += val;
-                }
-            }
+    int combineLevels() const {
+        return combine_levels;
+    }
 
-            for (int x = lower; x < upper; ++x) {
-                int next_x = x;
-                next_x += x & -x;
-                int val_agg = local_bits[x];
-                if (next_x < upper) {
-                    local_bits[next_x] += val_agg;
-                }
-                bits[x] += val_agg;
-                local_bits[x] = 0;
-            }
+    // The buffers are flushed at the end of every batchAdd, so between batches the nodes hold everything
+    SnapshotView snapshot() const {
+        static_assert(sizeof(std::atomic<T>) == sizeof(T), "snapshots store the atomics as plain nodes");
+        SnapshotView view;
+        view.add(reinterpret_cast<const T *>(bits.data()), bits.size());
+        return view;
+    }
 
-            #ifdef TIMING
-            auto end_time = omp_get_wtime();
-            execution_times[t] += end_time - start_time;
-            #endif
+    bool restore(const MappedSnapshot &snapshot) {
+        const T *nodes = snapshot.numArrays() == 1 ? snapshot.array<T>(0, bits.size()) : nullptr;
+        if (!nodes) {
+            return false;
+        }
+        #pragma omp parallel for
+        for (size_t x = 0; x < bits.size(); ++x) {
+            bits[x].store(nodes[x], std::memory_order_relaxed);
         }
+        return true;
     }
 
-    void printRanges() {
-        for (int i = 0; i != num_threads; ++i) {
-            std::cerr << "Thread " << i << ' ' << ranges[i].first << ' ' << ranges[i].second << '\n';
-        }
+    // Thread-safe add operation with relaxed atomic nodes
+    void add(Index x, T val) {
+        addDirect(x + 1, val);
     }
 
-    void statistics() {
-        for (auto time : execution_times) {
-            std::cerr << time << '\n';
+    // Not ordered against a concurrent add; exact between batches
+    T sum(Index x) const {
+        T total = Op::identity();
+        for (++x; x > 0; x -= x & -x) {
+            total = op(total, bits[x].load(std::memory_order_relaxed));
         }
+        return total;
     }
-};
 
-// Lazy Sync Fenwick Tree 
-// Current Imp: Less fine-grained: stop the world when read;
-// Can try but expect less perf
-// => More fine-grained: read/write sets => but might have huge cache coherency traffic
-class FenwickTreeLSync : public FenwickTreeBase {
-  private:
-    std::vector<std::atomic<int>> bits;
+    void batchAdd(Span<const Operation> operations) {
+        // Every thread flushes up to num_hot nodes, which only pays off if it has more updates than that
+        const bool combine = num_hot > 0 && operations.size() >= (size_t)num_hot * num_threads;
+        const Index hot_mask = (Index(1) << shift) - 1;
 
-  public:
-    FenwickTreeLSync(int n) : bits(n + 1) {}
+        #pragma omp parallel num_threads(num_threads)
+        {
+            int t = omp_get_thread_num();
 
-    // Thread-safe add operation with local lock
-    void add(int x, int val) override {
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x].fetch_add(val);
-        }
-    }
+            if (!combine) {
+                #pragma omp for
+                for (size_t i = 0; i < operations.size(); ++i) {
+                    addDirect(operations[i].index + 1, operations[i].value);
+                }
+            } else {
+                auto &buffer = buffers[t];
+                auto &touched = dirty[t];
+
+                #pragma omp for
+                for (size_t i = 0; i < operations.size(); ++i) {
+                    const T val = operations[i].value;
+                    Index x = operations[i].index + 1;
+                    for (; (x & hot_mask) && x < (Index)bits.size(); x += x & -x) {
+                        atomic_combine(bits[x], val, op, std::memory_order_relaxed);
+                    }
+                    if (x < (Index)bits.size()) {
+                        Index hot = x >> shift;
+                        buffer[hot] = op(buffer[hot], val);
+                        touched[hot] = 1;
+                    }
+                }
 
-    // Thread-safe sum operation (no locks needed with only 1 reader at a time)
-    int sum(int x) override {
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x].load();
+                flush(t);
+            }
         }
-        return total;
     }
 };
 
-// Lazy Sync Fenwick Tree but within (like Model-Parallel); still under construction
-// Many implementations: 
-class FenwickTreeLWithin : public FenwickTreeBase {
+// Lazy Sync Fenwick Tree but within (like Model-Parallel): batches walk per-thread ranges, readers wait for them
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+class FenwickTreeLWithin : public FenwickTree<T, Index, Op> {
     private:
-    std::vector<int> bits;
-    std::vector<std::pair<int, int>> ranges;
+    using Base = FenwickTree<T, Index, Op>;
+    using Base::bits;
+
+    std::vector<std::pair<Index, Index>> ranges;
     std::atomic<int> writes_;
     std::atomic<int> reads_;
 
-    void initialize_ranges(int n, int num_threads) {
+    void initialize_ranges(Index n, int num_threads) {
         std::vector<ulong> dp(n + 1);
         ulong total = 0;
-        for (int x = 1; x <= n; ++x) {
+        for (Index x = 1; x <= n; ++x) {
             ++dp[x];
             total += dp[x];
 
-            int next_x = x;
+            Index next_x = x;
             next_x += next_x & -next_x;
             if (next_x <= n) {
                 dp[next_x] += dp[x];
@@ -695,16 +1834,16 @@ class FenwickTreeLWithin : public FenwickTreeBase {
         }
 
         ulong average = total / num_threads;
-        int cur = 1;
+        Index cur = 1;
 
         for (int i = 0; i != num_threads; ++i) {
             ulong thread_total = 0;
             ranges[i].first = cur;
-            while (cur < (int)bits.size() && thread_total < average) {
+            while (cur < (Index)bits.size() && thread_total < average) {
                 thread_total += (ulong)dp[cur];
                 ++cur;
             }
-            while (cur < (int)bits.size() && cur % 64 != 0) {
+            while (cur < (Index)bits.size() && cur % 64 != 0) {
                 ++cur;
             }
             ranges[i].second = cur;
@@ -714,32 +1853,87 @@ class FenwickTreeLWithin : public FenwickTreeBase {
     }
 
   public:
-    FenwickTreeLWithin(int n, int num_threads):bits(n + 1, 0), ranges(num_threads) {
+    FenwickTreeLWithin(Index n, int num_threads) : Base(n), ranges(num_threads), writes_(0), reads_(0) {
         initialize_ranges(n, num_threads);
     }
 
-    void add(int x, int val) override {
-        // while (reads_.load(std::memory_order_acquire)) {}
-        // writes_.fetch_add(1, std::memory_order_acq_rel);
-
-        for (++x; x < (int)bits.size(); x += x & -x) {
-            bits[x] += val;
+    /**
+     * Stop the readers, then drain the ones already inside sum(). The writer
+     * announces itself before it looks at reads_, and a reader announces
+     * itself before it looks at writes_, so one of them always sees the
+     * other. One writer at a time: add() and batchAdd() must not overlap.
+     */
+    void beginWrite() {
+        writes_.fetch_add(1);
+        while (reads_.load()) {
+            std::this_thread::yield();
         }
-        // writes_.fetch_sub(1, std::memory_order_release);
     }
 
-    int sum(int x) override {
-        while (writes_.load(std::memory_order_acquire)) {}
-        reads_.fetch_add(1, std::memory_order_acq_rel);
+    void endWrite() {
+        writes_.fetch_sub(1, std::memory_order_release);
+    }
 
-        int total = 0;
-        for (++x; x > 0; x -= x & -x) {
-            total += bits[x];
+    void add(Index x, T val) {
+        beginWrite();
+        Base::add(x, val);
+        endWrite();
+    }
+
+    // The whole batch is one write, so a sum() sees all of it or none; thread t walks its own range
+    void batchAdd(Span<const Operation> operations) {
+        beginWrite();
+        #pragma omp parallel num_threads(ranges.size())
+        {
+            const auto [lower, upper] = ranges[omp_get_thread_num()];
+            for (const auto &operation : operations) {
+                Base::addWithin(operation.index + 1, operation.value, lower, upper);
+            }
+        }
+        endWrite();
+    }
+
+    // Waits while a write is in flight; FenwickTreeVersioned serves readers without waiting
+    T sum(Index x) {
+        while (true) {
+            reads_.fetch_add(1);
+            if (!writes_.load()) {
+                break;
+            }
+            reads_.fetch_sub(1, std::memory_order_release);
+            while (writes_.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
         }
 
+        T total = Base::sum(x);
+
         reads_.fetch_sub(1, std::memory_order_release);
         return total;
     }
 };
 
-#endif
\ No newline at end of file
+// Adapts any tree above to the type-erased FenwickTreeBase interface used by the CLI
+template <typename Tree>
+class FenwickTreeHandle final : public FenwickTreeBase {
+  private:
+    Tree tree;
+
+  public:
+    template <typename... Args>
+    explicit FenwickTreeHandle(Args &&...args) : tree(std::forward<Args>(args)...) {}
+
+    void add(int x, int val) override {
+        tree.add(x, val);
+    }
+
+    int sum(int x) override {
+        return tree.sum(x);
+    }
+
+    Tree &get() {
+        return tree;
+    }
+};
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * Fenwick tree sharded across MPI ranks, for index spaces larger than one
+ * machine. Rank r stores only the nodes [lower_r, upper_r), contiguous
+ * ranges of about the same access cost as the access-aware model-parallel
+ * tree uses for its threads. The cost of node x is lowbit(x), the number of
+ * indices whose update path goes through it, so the ranges are found by a
+ * binary search over its closed-form prefix sum instead of an O(n) table.
+ *
+ * batchAdd() is collective. Every rank sorts and merges its own updates,
+ * routes each distinct index to the ranks its update path enters, as the
+ * entry node from enter_range(), merges the entries per rank again and
+ * exchanges them in one MPI_Alltoallv. Each rank then walks the received
+ * entries within its nodes with its OpenMP threads, which split the local
+ * range the same way.
+ *
+ * batchSum() is collective too: the query indices of all ranks are
+ * gathered, every rank combines the nodes of its range on each query path
+ * and MPI_Reduce_scatter sums the partials back to the asking ranks.
+ * Sums only, the reduction is MPI_SUM.
+ */
+#ifndef FENWICK_MPI_H
+#define FENWICK_MPI_H
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <mpi.h>
+#include <omp.h>
+
+#include "fenwick.h"
+
+template <typename T, typename Index>
+struct PointUpdate {
+    Index index;  // 0-based
+    T value;
+};
+
+template <typename T>
+MPI_Datatype mpi_type();
+
+template <>
+inline MPI_Datatype mpi_type<int>() {
+    return MPI_INT;
+}
+
+template <>
+inline MPI_Datatype mpi_type<long long>() {
+    return MPI_LONG_LONG;
+}
+
+template <>
+inline MPI_Datatype mpi_type<double>() {
+    return MPI_DOUBLE;
+}
+
+// Total access cost lowbit(1) + ... + lowbit(m) of the nodes [1, m]
+inline unsigned long long access_cost_prefix(unsigned long long m) {
+    unsigned long long total = 0;
+    for (int b = 0; b < 64 && (m >> b) != 0; ++b) {
+        total += ((m >> b) - (m >> (b + 1))) << b;
+    }
+    return total;
+}
+
+/**
+ * Split the nodes [1, n] into `parts` contiguous ranges of about the same
+ * access cost, inner boundaries rounded to multiples of `alignment`.
+ */
+template <typename Index>
+std::vector<std::pair<Index, Index>> partition_access_cost(Index n, int parts, Index alignment) {
+    std::vector<std::pair<Index, Index>> ranges(parts);
+    const unsigned long long total = access_cost_prefix(n);
+
+    Index cur = 1;
+    for (int i = 0; i != parts; ++i) {
+        ranges[i].first = cur;
+        if (i + 1 == parts) {
+            cur = n + 1;
+        } else {
+            // Smallest m with cost(1..m) reaching the share of ranges 0..i
+            const unsigned long long target = (unsigned long long)((long double)total * (i + 1) / parts);
+            Index low = cur - 1, high = n;
+            while (low < high) {
+                Index mid = low + (high - low) / 2;
+                if (access_cost_prefix(mid) < target) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            Index boundary = (low + 1 + alignment / 2) / alignment * alignment;
+            cur = std::clamp(boundary, cur, n + 1);
+        }
+        ranges[i].second = cur;
+    }
+    return ranges;
+}
+
+template <typename T = long long, typename Index = long long>
+class FenwickTreeDistributed {
+  private:
+    using Entry = std::pair<Index, T>;
+
+    MPI_Comm comm;
+    int rank = 0;
+    int num_ranks = 1;
+    Index n;
+    Index end;
+    std::vector<std::pair<Index, Index>> ranges;
+    Index lower;
+    Index upper;
+
+    // Node x of the range is nodes[x - lower]
+    std::vector<T, TreeAllocator<T>> nodes;
+
+    MPI_Datatype entry_type;
+    std::vector<Entry> staged;
+    std::vector<Entry> staged_swap;
+    std::vector<std::vector<Entry>> outbox;
+    std::vector<Entry> send_buffer;
+    std::vector<Entry> receive_buffer;
+    std::vector<int> send_counts, send_offsets, receive_counts, receive_offsets;
+
+    std::vector<Index> query_indices;
+    std::vector<T> partial_sums;
+    std::vector<int> query_counts, query_offsets;
+
+    unsigned long long entries_sent = 0;
+
+    // Index of the rank whose range contains the 1-based node `x`
+    int owner(Index x) const {
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), x,
+            [](Index value, const std::pair<Index, Index> &range) { return value < range.first; });
+        return int(it - ranges.begin()) - 1;
+    }
+
+    // Sort [first, last), all keys in [low, high), merge equal keys; returns the merged end
+    Entry *sortAndMerge(Entry *first, Entry *last, Entry *swap, Index low, Index high) {
+        const Entry *sorted = radix_sort_by_key(first, last, swap, low, high);
+        Entry *merged = first;
+        for (const Entry *it = sorted; it != sorted + (last - first); ++it) {
+            if (merged != first && (merged - 1)->first == it->first) {
+                (merged - 1)->second += it->second;
+            } else {
+                *merged++ = *it;
+            }
+        }
+        return merged;
+    }
+
+  public:
+    FenwickTreeDistributed(Index n, MPI_Comm comm = MPI_COMM_WORLD) : comm(comm), n(n), end(n + 1) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &num_ranks);
+        const Index nodes_per_line = cache_line_size % sizeof(T) == 0 ? Index(cache_line_size / sizeof(T)) : 1;
+        ranges = partition_access_cost<Index>(n, num_ranks, nodes_per_line);
+        lower = ranges[rank].first;
+        upper = ranges[rank].second;
+
+        // Each thread first-touches the part of the range it updates
+        nodes.resize(upper - lower);
+        #pragma omp parallel
+        {
+            const auto [first, last] = threadRange(omp_get_thread_num(), omp_get_num_threads());
+            std::fill(nodes.begin() + (first - lower), nodes.begin() + (last - lower), T(0));
+        }
+
+        MPI_Type_contiguous(sizeof(Entry), MPI_BYTE, &entry_type);
+        MPI_Type_commit(&entry_type);
+        outbox.resize(num_ranks);
+        send_counts.resize(num_ranks);
+        send_offsets.resize(num_ranks);
+        receive_counts.resize(num_ranks);
+        receive_offsets.resize(num_ranks);
+        query_counts.resize(num_ranks);
+        query_offsets.resize(num_ranks);
+    }
+
+    ~FenwickTreeDistributed() {
+        MPI_Type_free(&entry_type);
+    }
+
+    FenwickTreeDistributed(const FenwickTreeDistributed &) = delete;
+    FenwickTreeDistributed &operator=(const FenwickTreeDistributed &) = delete;
+
+    // Nodes of the local range updated by thread t of `threads`
+    std::pair<Index, Index> threadRange(int t, int threads) const {
+        const Index width = upper - lower;
+        return {lower + (Index)((long long)width * t / threads), lower + (Index)((long long)width * (t + 1) / threads)};
+    }
+
+    /**
+     * Apply the m updates of this rank. Collective: every rank of the
+     * communicator calls it once per batch, with its own updates.
+     */
+    void batchAdd(const PointUpdate<T, Index> *updates, size_t m) {
+        staged.resize(m);
+        staged_swap.resize(m);
+        size_t count = 0;
+        for (size_t i = 0; i != m; ++i) {
+            if (updates[i].index >= 0 && updates[i].index < n) {
+                staged[count++] = {updates[i].index + 1, updates[i].value};
+            }
+        }
+        Entry *merged = sortAndMerge(staged.data(), staged.data() + count, staged_swap.data(), 1, end);
+
+        for (auto &out : outbox) {
+            out.clear();
+        }
+        for (Entry *it = staged.data(); it != merged; ++it) {
+            auto [x, val] = *it;
+            int r = owner(x);
+            while (true) {
+                outbox[r].emplace_back(x, val);
+                x = enter_range(x, ranges[r].second);
+                if (x >= end) {
+                    break;
+                }
+                while (ranges[r].second <= x) {
+                    ++r;
+                }
+            }
+        }
+
+        // Paths of different indices share their entry nodes into the high ranges
+        size_t total = 0;
+        for (int r = 0; r != num_ranks; ++r) {
+            auto &out = outbox[r];
+            staged_swap.resize(std::max(staged_swap.size(), out.size()));
+            out.resize(sortAndMerge(out.data(), out.data() + out.size(), staged_swap.data(),
+                                    ranges[r].first, ranges[r].second) - out.data());
+            send_counts[r] = (int)out.size();
+            send_offsets[r] = (int)total;
+            total += out.size();
+        }
+        send_buffer.resize(total);
+        for (int r = 0; r != num_ranks; ++r) {
+            std::copy(outbox[r].begin(), outbox[r].end(), send_buffer.begin() + send_offsets[r]);
+        }
+        entries_sent += total - send_counts[rank];
+
+        MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1, MPI_INT, comm);
+        size_t received = 0;
+        for (int r = 0; r != num_ranks; ++r) {
+            receive_offsets[r] = (int)received;
+            received += receive_counts[r];
+        }
+        receive_buffer.resize(received);
+        MPI_Alltoallv(send_buffer.data(), send_counts.data(), send_offsets.data(), entry_type,
+                      receive_buffer.data(), receive_counts.data(), receive_offsets.data(), entry_type, comm);
+
+        #pragma omp parallel
+        {
+            const auto [first, last] = threadRange(omp_get_thread_num(), omp_get_num_threads());
+            for (const auto &[entry, val] : receive_buffer) {
+                for (Index x = enter_range(entry, first); x < last; x += x & -x) {
+                    nodes[x - lower] += val;
+                }
+            }
+        }
+    }
+
+    /**
+     * Answer out[i] = sum(idx[i]) for the k queries of this rank.
+     * Collective, every rank calls it with its own queries.
+     */
+    void batchSum(const Index *idx, T *out, size_t k) {
+        int local = (int)k;
+        MPI_Allgather(&local, 1, MPI_INT, query_counts.data(), 1, MPI_INT, comm);
+        size_t total = 0;
+        for (int r = 0; r != num_ranks; ++r) {
+            query_offsets[r] = (int)total;
+            total += query_counts[r];
+        }
+        query_indices.resize(total);
+        MPI_Allgatherv(idx, local, mpi_type<Index>(), query_indices.data(), query_counts.data(),
+                       query_offsets.data(), mpi_type<Index>(), comm);
+
+        partial_sums.resize(total);
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < total; ++i) {
+            T partial = 0;
+            for (Index x = below_range(query_indices[i] + 1, upper); x >= lower && x > 0; x -= x & -x) {
+                partial += nodes[x - lower];
+            }
+            partial_sums[i] = partial;
+        }
+        MPI_Reduce_scatter(partial_sums.data(), out, query_counts.data(), mpi_type<T>(), MPI_SUM, comm);
+    }
+
+    // Prefix sum of [0, x], collective with the same `x` on every rank
+    T sum(Index x) {
+        T partial = 0;
+        for (x = below_range(x + 1, upper); x >= lower && x > 0; x -= x & -x) {
+            partial += nodes[x - lower];
+        }
+        T total = 0;
+        MPI_Allreduce(&partial, &total, 1, mpi_type<T>(), MPI_SUM, comm);
+        return total;
+    }
+
+    Index size() const {
+        return n;
+    }
+
+    // The nodes [first, second) of every rank
+    const std::vector<std::pair<Index, Index>> &rankRanges() const {
+        return ranges;
+    }
+
+    // Entries this rank sent to other ranks in all batchAdd calls so far
+    unsigned long long entriesSent() const {
+        return entries_sent;
+    }
+
+    void printRanges() const {
+        if (rank == 0) {
+            for (int r = 0; r != num_ranks; ++r) {
+                std::cerr << "Rank " << r << ' ' << ranges[r].first << ' ' << ranges[r].second << '\n';
+            }
+        }
+    }
+};
+
+#endif
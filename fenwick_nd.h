@@ -0,0 +1,310 @@
+/**
+ * Multi-dimensional Fenwick Trees. Node (x_0, ..., x_{D-1}) covers the box
+ * whose side in dimension k is the Fenwick range of x_k, so an update or a
+ * prefix query walks the nested product of the 1D paths, O(log^D n).
+ * The node array is addressed through a layout policy: plain row-major, or
+ * tiles of 2^TileBits nodes per side stored contiguously.
+ */
+#ifndef FENWICK_ND_H
+#define FENWICK_ND_H
+
+#include <array>
+#include <vector>
+#include <omp.h>
+
+#include "fenwick.h"
+
+template <typename T, typename Index, size_t D>
+struct OperationND {
+    char command;
+    std::array<Index, D> index;
+    T value;
+};
+
+// Row-major layout over the extents (n_k + 1) of the 1-based node coordinates
+template <typename Index, size_t D>
+class RowMajorLayout {
+  private:
+    std::array<size_t, D> extent;
+
+  public:
+    explicit RowMajorLayout(const std::array<Index, D> &n) {
+        for (size_t k = 0; k != D; ++k) {
+            extent[k] = size_t(n[k]) + 1;
+        }
+    }
+
+    size_t size() const {
+        size_t total = 1;
+        for (auto e : extent) {
+            total *= e;
+        }
+        return total;
+    }
+
+    size_t offset(const std::array<Index, D> &x) const {
+        size_t result = x[0];
+        for (size_t k = 1; k != D; ++k) {
+            result = result * extent[k] + x[k];
+        }
+        return result;
+    }
+};
+
+/**
+ * Tiled layout: the coordinates are split into a tile number and an offset
+ * within the tile, both row-major. The default 4x4 tile of int is one
+ * cache line, so the short low-order steps of the inner walks stay within
+ * the lines already loaded by the outer walk.
+ */
+template <typename Index, size_t D, size_t TileBits = 2>
+class TiledLayout {
+  private:
+    static constexpr size_t tile = size_t(1) << TileBits;
+    static constexpr size_t mask = tile - 1;
+
+    std::array<size_t, D> tiles;
+
+  public:
+    explicit TiledLayout(const std::array<Index, D> &n) {
+        for (size_t k = 0; k != D; ++k) {
+            tiles[k] = (size_t(n[k]) + tile) >> TileBits;
+        }
+    }
+
+    size_t size() const {
+        size_t total = 1;
+        for (auto t : tiles) {
+            total *= t << TileBits;
+        }
+        return total;
+    }
+
+    size_t offset(const std::array<Index, D> &x) const {
+        size_t outer = size_t(x[0]) >> TileBits;
+        size_t inner = size_t(x[0]) & mask;
+        for (size_t k = 1; k != D; ++k) {
+            outer = outer * tiles[k] + (size_t(x[k]) >> TileBits);
+            inner = (inner << TileBits) | (size_t(x[k]) & mask);
+        }
+        return (outer << (TileBits * D)) | inner;
+    }
+};
+
+// Core N-D Fenwick Tree over the grid [0, n_0) x ... x [0, n_{D-1})
+template <typename T = int, typename Index = int, size_t D = 2, typename Op = Plus<T>,
+          typename Layout = RowMajorLayout<Index, D>>
+class FenwickTreeND {
+  public:
+    using value_type = T;
+    using index_type = Index;
+    using op_type = Op;
+    using point_type = std::array<Index, D>;
+
+  protected:
+    point_type n;
+    Layout layout;
+    std::vector<T, TreeAllocator<T>> bits;
+    Op op;
+
+    // Combine val into every node on the update paths of dimensions K.. of the 1-based `x`, returns the writes if counted
+    template <size_t K, bool Count = false>
+    size_t addFrom(point_type &node, const point_type &x, T val) {
+        size_t writes = 0;
+        for (node[K] = x[K]; node[K] <= n[K]; node[K] += node[K] & -node[K]) {
+            if constexpr (K + 1 == D) {
+                auto &bit = bits[layout.offset(node)];
+                bit = op(bit, val);
+                if constexpr (Count) {
+                    ++writes;
+                }
+            } else {
+                writes += addFrom<K + 1, Count>(node, x, val);
+            }
+        }
+        return writes;
+    }
+
+    template <size_t K>
+    T sumFrom(point_type &node, const point_type &x) const {
+        T res = Op::identity();
+        for (node[K] = x[K]; node[K] > 0; node[K] -= node[K] & -node[K]) {
+            if constexpr (K + 1 == D) {
+                res = op(res, bits[layout.offset(node)]);
+            } else {
+                res = op(res, sumFrom<K + 1>(node, x));
+            }
+        }
+        return res;
+    }
+
+  public:
+    explicit FenwickTreeND(const point_type &n) : n(n), layout(n), bits(layout.size(), Op::identity()) {}
+
+    const point_type &size() const {
+        return n;
+    }
+
+    // The nodes in layout order; a snapshot only restores into a tree of the same dimensions and layout
+    SnapshotView snapshot() const {
+        SnapshotView view;
+        view.add(bits.data(), bits.size());
+        return view;
+    }
+
+    bool restore(const MappedSnapshot &snapshot) {
+        const T *nodes = snapshot.numArrays() == 1 ? snapshot.array<T>(0, bits.size()) : nullptr;
+        if (!nodes) {
+            return false;
+        }
+        std::copy(nodes, nodes + bits.size(), bits.begin());
+        return true;
+    }
+
+    void add(const point_type &x, T val) {
+        point_type x1, node;
+        for (size_t k = 0; k != D; ++k) {
+            x1[k] = x[k] + 1;
+        }
+        addFrom<0>(node, x1, val);
+    }
+
+    // Combine over the box [0, x_0] x ... x [0, x_{D-1}]
+    T sum(const point_type &x) const {
+        point_type x1, node;
+        for (size_t k = 0; k != D; ++k) {
+            x1[k] = x[k] + 1;
+        }
+        return sumFrom<0>(node, x1);
+    }
+
+    // Sum over the box [lo, hi] by inclusion-exclusion over its 2^D corners, Plus only
+    T boxSum(const point_type &lo, const point_type &hi) const {
+        T res = T(0);
+        for (size_t mask = 0; mask != (size_t(1) << D); ++mask) {
+            point_type corner;
+            bool empty = false;
+            for (size_t k = 0; k != D; ++k) {
+                corner[k] = (mask >> k & 1) ? lo[k] - 1 : hi[k];
+                empty |= corner[k] < 0;
+            }
+            if (!empty) {
+                res += (__builtin_popcountll(mask) & 1) ? -sum(corner) : sum(corner);
+            }
+        }
+        return res;
+    }
+
+    // Update only the nodes whose outer coordinate lies within [lower, upper), `x` is 1-based
+    template <bool Count = false>
+    size_t addWithin(const point_type &x, T val, Index lower, Index upper, std::bool_constant<Count> = {}) {
+        size_t writes = 0;
+        point_type node;
+        for (node[0] = enter_range<Index>(x[0], lower); node[0] < upper; node[0] += node[0] & -node[0]) {
+            if constexpr (D == 1) {
+                auto &bit = bits[layout.offset(node)];
+                bit = op(bit, val);
+                if constexpr (Count) {
+                    ++writes;
+                }
+            } else {
+                writes += addFrom<1, Count>(node, x, val);
+            }
+        }
+        return writes;
+    }
+};
+
+template <typename T = int, typename Index = int, size_t D = 2, typename Op = Plus<T>,
+          typename Layout = RowMajorLayout<Index, D>>
+class FenwickTreeNDSequential : public FenwickTreeND<T, Index, D, Op, Layout> {
+  private:
+    using Base = FenwickTreeND<T, Index, D, Op, Layout>;
+
+  public:
+    using Base::Base;
+
+    void batchAdd(const std::vector<OperationND<T, Index, D>> &operations) {
+        for (const auto &operation : operations) {
+            if (operation.command == 'a') {
+                Base::add(operation.index, operation.value);
+            }
+        }
+    }
+};
+
+/**
+ * Model-parallel N-D tree: the outer dimension is partitioned exactly like
+ * the 1D access-aware tree, thread t owns every node whose outer coordinate
+ * lies in ranges[t] and replays the whole batch within it. The inner walks
+ * cost the same for every outer node, so the 1D access cost of the outer
+ * dimension balances the writes.
+ */
+template <typename T = int, typename Index = int, size_t D = 2, typename Op = Plus<T>,
+          typename Layout = RowMajorLayout<Index, D>>
+class FenwickTreeNDModelParallel : public FenwickTreeND<T, Index, D, Op, Layout> {
+  private:
+    using Base = FenwickTreeND<T, Index, D, Op, Layout>;
+    using point_type = typename Base::point_type;
+
+    int num_threads;
+    std::vector<std::pair<Index, Index>> ranges;
+    Instrumentation stats;
+
+  public:
+    FenwickTreeNDModelParallel(const point_type &n, int num_threads) :
+        Base(n),
+        num_threads(num_threads),
+        ranges(partition_ranges<Index>(access_cost(n[0]), num_threads)),
+        stats(num_threads) {}
+
+    void batchAdd(const std::vector<OperationND<T, Index, D>> &operations) {
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num();
+            const auto [lower, upper] = ranges[t];
+
+            instrumented_batch(stats, t, [&](bool count) {
+                size_t writes = 0;
+                for (const auto &operation : operations) {
+                    if (operation.command != 'a') {
+                        continue;
+                    }
+                    point_type x;
+                    for (size_t k = 0; k != D; ++k) {
+                        x[k] = operation.index[k] + 1;
+                    }
+                    writes += count ? Base::addWithin(x, operation.value, lower, upper, std::true_type())
+                                    : Base::addWithin(x, operation.value, lower, upper);
+                }
+                return writes;
+            });
+        }
+    }
+
+    void printRanges() {
+        for (int i = 0; i != num_threads; ++i) {
+            std::cerr << "Thread " << i << ' ' << ranges[i].first << ' ' << ranges[i].second << '\n';
+        }
+    }
+
+    void setInstrumentation(bool enable) {
+        stats.enable(enable);
+    }
+
+    const Instrumentation &instrumentation() const {
+        return stats;
+    }
+
+    void statistics(std::ostream &out = std::cerr) const {
+        stats.writeJson(out, ranges);
+    }
+};
+
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+using FenwickTree2D = FenwickTreeND<T, Index, 2, Op>;
+
+template <typename T = int, typename Index = int, typename Op = Plus<T>>
+using FenwickTree2DTiled = FenwickTreeND<T, Index, 2, Op, TiledLayout<Index, 2>>;
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * Range-update / range-query Fenwick Trees built on the dual-BIT technique.
+ * With d[j] = a[j] - a[j - 1], adding v to [l, r] is two point updates
+ * d[l] += v and d[r + 1] -= v, and
+ *     sum(x) = (x + 1) * (d[0] + ... + d[x]) - (0 * d[0] + ... + x * d[x]).
+ * The two prefix sums are kept together in one node, so a single walk
+ * updates both.
+ */
+#ifndef FENWICK_RANGE_H
+#define FENWICK_RANGE_H
+
+#include <vector>
+#include <omp.h>
+
+#include "fenwick.h"
+#include "generator.h"
+
+template <typename T>
+struct RangeNode {
+    T d;
+    T jd;
+};
+
+template <typename T>
+struct RangePlus {
+    static constexpr RangeNode<T> identity() { return {T(0), T(0)}; }
+    constexpr RangeNode<T> operator()(const RangeNode<T> &a, const RangeNode<T> &b) const {
+        return {a.d + b.d, a.jd + b.jd};
+    }
+};
+
+// Point update of the underlying difference tree
+template <typename T, typename Index>
+struct RangeUpdate {
+    Index index;
+    RangeNode<T> value;
+};
+
+/**
+ * Inclusive range [l, r] and value of an update: 'r' covers [index, right],
+ * 'a' only its index, and queries add nothing.
+ */
+template <typename T, typename Index>
+inline void decode_range(const RangeOperation &operation, Index &l, Index &r, T &val) {
+    l = operation.index;
+    r = range_end(operation);
+    val = operation.command == 'q' ? T(0) : T(operation.value);
+}
+
+// The products j * d[j] overflow 32 bits quickly, hence the 64-bit default
+template <typename T = long long, typename Index = int>
+class FenwickTreeRangeSequential {
+  private:
+    FenwickTree<RangeNode<T>, Index, RangePlus<T>> tree;
+
+  public:
+    FenwickTreeRangeSequential(Index n) : tree(n) {}
+
+    Index size() const {
+        return tree.size();
+    }
+
+    SnapshotView snapshot() const {
+        return tree.snapshot();
+    }
+
+    bool restore(const MappedSnapshot &snapshot) {
+        return tree.restore(snapshot);
+    }
+
+    // Add `val` to every entry in [l, r]
+    void rangeAdd(Index l, Index r, T val) {
+        tree.add(l, {val, val * l});
+        tree.add(r + 1, {-val, -val * (r + 1)});
+    }
+
+    void add(Index x, T val) {
+        rangeAdd(x, x, val);
+    }
+
+    // Sum over [0, x]
+    T sum(Index x) const {
+        auto total = tree.sum(x);
+        return T(x + 1) * total.d - total.jd;
+    }
+
+    // Sum over [l, r]
+    T rangeSum(Index l, Index r) const {
+        return sum(r) - (l > 0 ? sum(l - 1) : T(0));
+    }
+
+    void batchAdd(Span<const RangeOperation> operations) {
+        for (const auto &operation : operations) {
+            Index l, r;
+            T val;
+            decode_range(operation, l, r, val);
+            rangeAdd(l, r, val);
+        }
+    }
+};
+
+// Model-parallel batch version: the batch is expanded into point updates, then each thread walks its own range
+template <typename T = long long, typename Index = int>
+class FenwickTreeRangeModelParallel : protected FenwickTreeModelParallelBase<RangeNode<T>, Index, RangePlus<T>> {
+  private:
+    using Base = FenwickTreeModelParallelBase<RangeNode<T>, Index, RangePlus<T>>;
+    using Base::ranges;
+    using Base::stats;
+
+    std::vector<RangeUpdate<T, Index>> updates;
+
+  public:
+    using Base::setPreprocess;
+    using Base::printRanges;
+    using Base::setInstrumentation;
+    using Base::instrumentation;
+    using Base::statistics;
+    using Base::snapshot;
+    using Base::restore;
+
+    FenwickTreeRangeModelParallel(Index n, int num_threads) : Base(n, num_threads) {
+        Base::initialize_ranges(access_cost(n));
+    }
+
+    Index size() const {
+        return Base::size();
+    }
+
+    // Sum over [0, x]
+    T sum(Index x) const {
+        auto total = Base::sum(x);
+        return T(x + 1) * total.d - total.jd;
+    }
+
+    // Sum over [l, r]
+    T rangeSum(Index l, Index r) const {
+        return sum(r) - (l > 0 ? sum(l - 1) : T(0));
+    }
+
+    void batchAdd(Span<const RangeOperation> operations) {
+        updates.resize(2 * operations.size());
+
+        #pragma omp parallel
+        {
+            ScopedPin pin(openmp_thread_cpu());
+            #pragma omp for
+            for (size_t i = 0; i < operations.size(); ++i) {
+                Index l, r;
+                T val;
+                decode_range(operations[i], l, r, val);
+                updates[2 * i] = {l, {val, val * l}};
+                updates[2 * i + 1] = {r + 1, {-val, -val * (r + 1)}};
+            }
+
+            int t = omp_get_thread_num();
+            const auto [lower, upper] = ranges[t];
+
+            instrumented_batch(stats, t, [&](bool count) {
+                Span<const RangeUpdate<T, Index>> batch(updates);
+                return count ? Base::walkBatch(batch, t, lower, upper, std::true_type())
+                             : Base::walkBatch(batch, t, lower, upper);
+            });
+        }
+    }
+};
+
+// Lock-free version: two atomic trees, the updates of a batch run concurrently
+template <typename T = long long, typename Index = int>
+class FenwickTreeRangeLSync {
+  private:
+    FenwickTreeLSync<T, Index> d;
+    FenwickTreeLSync<T, Index> jd;
+
+  public:
+    FenwickTreeRangeLSync(Index n) : d(n), jd(n) {}
+
+    // The d tree, then the jd tree
+    SnapshotView snapshot() const {
+        SnapshotView view = d.snapshot();
+        view.append(jd.snapshot());
+        return view;
+    }
+
+    bool restore(const MappedSnapshot &snapshot) {
+        return snapshot.numArrays() == 2 && d.restoreArray(snapshot, 0) && jd.restoreArray(snapshot, 1);
+    }
+
+    // Thread-safe: add `val` to every entry in [l, r]
+    void rangeAdd(Index l, Index r, T val) {
+        d.add(l, val);
+        d.add(r + 1, -val);
+        jd.add(l, val * l);
+        jd.add(r + 1, -val * (r + 1));
+    }
+
+    void add(Index x, T val) {
+        rangeAdd(x, x, val);
+    }
+
+    // Sum over [0, x]; only consistent with no add in flight
+    T sum(Index x) const {
+        return T(x + 1) * d.sum(x) - jd.sum(x);
+    }
+
+    // Sum over [l, r]
+    T rangeSum(Index l, Index r) const {
+        return sum(r) - (l > 0 ? sum(l - 1) : T(0));
+    }
+
+    void batchAdd(Span<const RangeOperation> operations) {
+        #pragma omp parallel for
+        for (size_t i = 0; i < operations.size(); ++i) {
+            Index l, r;
+            T val;
+            decode_range(operations[i], l, r, val);
+            rangeAdd(l, r, val);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * Range fold of FenwickTreeModelParallelAggregate: the per-thread deltas
+ * local[lower, upper) are carried up their update paths within the range,
+ * added to the tree nodes and cleared. The scalar loop carries node by
+ * node and every step depends on the previous one. The SIMD kernels fold
+ * level by level instead: a node y only carries into y + lowbit(y), whose
+ * lowbit is larger, so after the levels below lowbit(x) the delta of x is
+ * final. The low levels of an aligned block of W nodes [W*m + 1, W*m + W]
+ * carry only within the block, so each block folds them in registers with
+ * one masked lane permute and add per level. The upper levels touch one
+ * node in W and stay scalar; the final add and clear are contiguous.
+ * The kernel is chosen at run time from the CPU features, for int sums.
+ */
+#ifndef FOLD_KERNELS_H
+#define FOLD_KERNELS_H
+
+#include <algorithm>
+#include <string>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Carry the nodes of [begin, end) at the levels [first_level, last_level) into their in-range parents
+inline void fold_levels(int *local, long begin, long end, long upper, int first_level, int last_level) {
+    for (int b = first_level; b < last_level && (1L << b) < upper; ++b) {
+        const long step = 1L << b;
+        long x = (begin + step - 1) >> b;
+        x = (x | 1) << b;
+        for (; x < end && x + step < upper; x += 2 * step) {
+            local[x + step] += local[x];
+        }
+    }
+}
+
+// Levels [levels, 64): one node in 2^levels, strided
+inline void fold_upper_levels(int *local, long lower, long upper, int levels) {
+    fold_levels(local, lower, upper, upper, levels, 63);
+}
+
+// Node by node in index order, as the tree folds any other value type
+inline void fold_range_int_scalar(int *bits, int *local, long lower, long upper) {
+    for (long x = lower; x < upper; ++x) {
+        long next_x = x + (x & -x);
+        if (next_x < upper) {
+            local[next_x] += local[x];
+        }
+        bits[x] += local[x];
+        local[x] = 0;
+    }
+}
+
+// Full blocks [s, s + width) of `width` nodes with s = width * m + 1 inside [lower, upper)
+inline void full_blocks(long lower, long upper, long width, long &first, long &last) {
+    first = (lower - 1 + width - 1) / width * width + 1;
+    last = std::max(first, (upper - 1) / width * width + 1);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline void fold_range_avx2(int *bits, int *local, long lower, long upper) {
+    long first, last;
+    full_blocks(lower, upper, 8, first, last);
+    if (first >= upper) {
+        first = last = upper;
+    }
+
+    // Levels 0..2: lane j holds node s + j and, at level b, the lanes of mask b take lane j - 2^b
+    const __m256i from0 = _mm256_setr_epi32(0, 0, 0, 2, 0, 4, 0, 6);
+    const __m256i mask0 = _mm256_setr_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+    const __m256i from1 = _mm256_setr_epi32(0, 0, 0, 1, 0, 0, 0, 5);
+    const __m256i mask1 = _mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1);
+    const __m256i from2 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, 3);
+    const __m256i mask2 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, -1);
+    fold_levels(local, lower, first, upper, 0, 3);
+    for (long s = first; s < last; s += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(local + s));
+        v = _mm256_add_epi32(v, _mm256_and_si256(_mm256_permutevar8x32_epi32(v, from0), mask0));
+        v = _mm256_add_epi32(v, _mm256_and_si256(_mm256_permutevar8x32_epi32(v, from1), mask1));
+        v = _mm256_add_epi32(v, _mm256_and_si256(_mm256_permutevar8x32_epi32(v, from2), mask2));
+        _mm256_storeu_si256((__m256i *)(local + s), v);
+    }
+    fold_levels(local, last, upper, upper, 0, 3);
+    fold_upper_levels(local, lower, upper, 3);
+
+    long x = lower;
+    const __m256i zero = _mm256_setzero_si256();
+    for (; x + 8 <= upper; x += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(local + x));
+        __m256i t = _mm256_loadu_si256((const __m256i *)(bits + x));
+        _mm256_storeu_si256((__m256i *)(bits + x), _mm256_add_epi32(t, d));
+        _mm256_storeu_si256((__m256i *)(local + x), zero);
+    }
+    for (; x < upper; ++x) {
+        bits[x] += local[x];
+        local[x] = 0;
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void fold_range_avx512(int *bits, int *local, long lower, long upper) {
+    long first, last;
+    full_blocks(lower, upper, 16, first, last);
+    if (first >= upper) {
+        first = last = upper;
+    }
+
+    // Levels 0..3 of a block of 16, the lanes taking a carry at level b are k * 2^(b+1) - 1
+    const __m512i from0 = _mm512_setr_epi32(0, 0, 0, 2, 0, 4, 0, 6, 0, 8, 0, 10, 0, 12, 0, 14);
+    const __m512i from1 = _mm512_setr_epi32(0, 0, 0, 1, 0, 0, 0, 5, 0, 0, 0, 9, 0, 0, 0, 13);
+    const __m512i from2 = _mm512_setr_epi32(0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 11);
+    const __m512i from3 = _mm512_setr_epi32(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7);
+    fold_levels(local, lower, first, upper, 0, 4);
+    for (long s = first; s < last; s += 16) {
+        __m512i v = _mm512_loadu_si512(local + s);
+        v = _mm512_add_epi32(v, _mm512_maskz_permutexvar_epi32(0xAAAA, from0, v));
+        v = _mm512_add_epi32(v, _mm512_maskz_permutexvar_epi32(0x8888, from1, v));
+        v = _mm512_add_epi32(v, _mm512_maskz_permutexvar_epi32(0x8080, from2, v));
+        v = _mm512_add_epi32(v, _mm512_maskz_permutexvar_epi32(0x8000, from3, v));
+        _mm512_storeu_si512(local + s, v);
+    }
+    fold_levels(local, last, upper, upper, 0, 4);
+    fold_upper_levels(local, lower, upper, 4);
+
+    long x = lower;
+    const __m512i zero = _mm512_set1_epi32(0);
+    for (; x + 16 <= upper; x += 16) {
+        __m512i d = _mm512_loadu_si512(local + x);
+        __m512i t = _mm512_loadu_si512(bits + x);
+        _mm512_storeu_si512(bits + x, _mm512_add_epi32(t, d));
+        _mm512_storeu_si512(local + x, zero);
+    }
+    for (; x < upper; ++x) {
+        bits[x] += local[x];
+        local[x] = 0;
+    }
+}
+#endif
+
+using FoldKernel = void (*)(int *bits, int *local, long lower, long upper);
+
+/**
+ * Kernel by name: scalar, avx2, avx512, or auto for the widest one the CPU
+ * supports. Returns nullptr for an unknown name or a missing instruction set.
+ */
+inline FoldKernel find_fold_kernel(const std::string &name) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    const bool avx2 = __builtin_cpu_supports("avx2");
+    const bool avx512 = __builtin_cpu_supports("avx512f");
+    if (name == "avx512" || (name == "auto" && avx512)) {
+        return avx512 ? fold_range_avx512 : nullptr;
+    }
+    if (name == "avx2" || (name == "auto" && avx2)) {
+        return avx2 ? fold_range_avx2 : nullptr;
+    }
+#endif
+    return name == "scalar" || name == "auto" ? fold_range_int_scalar : nullptr;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import random
 import argparse
+import struct
 
 def generate_fenwick_tree_input(size, num_operations, output_file, query_percentage=20):
     """
@@ -35,12 +36,33 @@ def generate_fenwick_tree_input(size, num_operations, output_file, query_percent
                 value = random.randint(1, 100)
                 f.write(f"{op_type} {index} {value}\n")
 
+def generate_fenwick_tree_trace(size, num_operations, output_file, query_percentage=20):
+    """
+    Generate a binary operation trace that `fenwick -f` replays memory-mapped.
+
+    Layout (little-endian, matching TraceHeader and Operation in generator.h):
+        header: magic "FWTRACE\\0", version, sizeof(Operation), size, count
+        records: command (char, 3 padding bytes), index, value (int32)
+    """
+    with open(output_file, 'wb') as f:
+        f.write(struct.pack('<8sIIqQ', b'FWTRACE\0', 2, 12, size, num_operations))
+
+        for _ in range(num_operations):
+            op_type = random.choices(['a', 'q'],
+                                    weights=[(100 - query_percentage),
+                                             query_percentage],
+                                    k=1)[0]
+            index = random.randint(0, size - 1)
+            value = random.randint(1, 100) if op_type == 'a' else 0
+            f.write(struct.pack('<c3xii', op_type.encode(), index, value))
+
 def main():
     parser = argparse.ArgumentParser(description='Generate test input for Fenwick Tree')
     parser.add_argument('--size', type=int, default=128, help='Size of the Fenwick tree')
     parser.add_argument('--operations', type=int, default=1000, help='Number of operations to generate')
     parser.add_argument('--output', type=str, default='input.txt', help='Output file path')
     parser.add_argument('--queries', type=int, default=20, help='Percentage of query operations (0-100)')
+    parser.add_argument('--binary', action='store_true', help='Write a binary trace for `fenwick -f` instead of text')
     
     args = parser.parse_args()
     
@@ -52,7 +74,10 @@ def main():
     if not 0 <= args.queries <= 100:
         parser.error("Query percentage must be between 0 and 100")
     
-    generate_fenwick_tree_input(args.size, args.operations, args.output, args.queries)
+    if args.binary:
+        generate_fenwick_tree_trace(args.size, args.operations, args.output, args.queries)
+    else:
+        generate_fenwick_tree_input(args.size, args.operations, args.output, args.queries)
     print(f"Generated {args.operations} operations for a Fenwick tree of size {args.size}")
     print(f"Output written to {args.output}")
 
@@ -1,7 +1,14 @@
 #ifndef GENERATOR_H
 #define GENERATOR_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 struct Operation {
     char command;
@@ -9,34 +16,319 @@ struct Operation {
     int value;
 };
 
+// Operation of the range strategies only: 'r' adds `value` to every index in [index, right]
+struct RangeOperation {
+    char command;
+    int index;
+    int value;
+    int right;
+};
+
+// A point operation as a range operation, its range the single index
+inline RangeOperation widen(const Operation &operation) {
+    return {operation.command, operation.index, operation.value, operation.index};
+}
+
+// Last index an operation covers
+inline int range_end(const Operation &operation) {
+    return operation.index;
+}
+
+inline int range_end(const RangeOperation &operation) {
+    return operation.command == 'r' ? operation.right : operation.index;
+}
+
+// Index distribution of the generated operations, over [0, size)
+class IndexDistribution {
+  public:
+    virtual ~IndexDistribution() = default;
+    virtual int next(std::mt19937 &rng) = 0;
+};
+
+class UniformIndex : public IndexDistribution {
+  private:
+    std::uniform_int_distribution<int> index_dist;
+
+  public:
+    UniformIndex(int size) : index_dist(0, size - 1) {}
+
+    int next(std::mt19937 &rng) override {
+        return index_dist(rng);
+    }
+};
+
+/**
+ * Zipf distribution with exponent `s`: index i is drawn with probability
+ * proportional to 1 / (i + 1)^s, so the hot keys sit at the low end where
+ * the update paths are longest. Rejection-inversion sampling (Hormann and
+ * Derflinger), O(1) per draw and no table over the key space.
+ */
+class ZipfIndex : public IndexDistribution {
+  private:
+    int size;
+    double s;
+    double h_integral_x1;
+    double h_integral_size;
+    double threshold;
+    std::uniform_real_distribution<double> unit_dist;
+
+    // log1p(x) / x and expm1(x) / x, stable around 0
+    static double helper1(double x) {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    static double helper2(double x) {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+    }
+
+    // h(x) = x^-s and its integral H(x) = (x^(1 - s) - 1) / (1 - s)
+    double h(double x) const {
+        return std::exp(-s * std::log(x));
+    }
+
+    double hIntegral(double x) const {
+        double log_x = std::log(x);
+        return helper2((1 - s) * log_x) * log_x;
+    }
+
+    double hIntegralInverse(double x) const {
+        double t = std::max(x * (1 - s), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+  public:
+    ZipfIndex(int size, double s) : size(size), s(s), unit_dist(0, 1) {
+        h_integral_x1 = hIntegral(1.5) - 1;
+        h_integral_size = hIntegral(size + 0.5);
+        threshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+    }
+
+    int next(std::mt19937 &rng) override {
+        while (true) {
+            double u = h_integral_size + unit_dist(rng) * (h_integral_x1 - h_integral_size);
+            double x = hIntegralInverse(u);
+            int k = std::clamp((int)(x + 0.5), 1, size);
+            if (k - x <= threshold || u >= hIntegral(k + 0.5) - h(k)) {
+                return k - 1;
+            }
+        }
+    }
+};
+
+// A `probability` share of the draws fall uniformly into a hot region of `fraction` * size keys
+class HotspotIndex : public IndexDistribution {
+  private:
+    std::uniform_int_distribution<int> index_dist;
+    std::uniform_int_distribution<int> hot_dist;
+    std::bernoulli_distribution hot_coin;
+
+  public:
+    HotspotIndex(int size, double fraction, double probability, int hot_begin)
+        : index_dist(0, size - 1),
+          hot_dist(hot_begin, std::min(size - 1, hot_begin + std::max(1, (int)(fraction * size)) - 1)),
+          hot_coin(probability) {}
+
+    int next(std::mt19937 &rng) override {
+        return hot_coin(rng) ? hot_dist(rng) : index_dist(rng);
+    }
+};
+
+// Indices 0, stride, 2 * stride, ... wrapping around the key space
+class SequentialIndex : public IndexDistribution {
+  private:
+    long long size;
+    long long stride;
+    long long cur = 0;
+
+  public:
+    SequentialIndex(int size, int stride) : size(size), stride(stride) {}
+
+    int next(std::mt19937 &) override {
+        int index = (int)cur;
+        cur = (cur + stride) % size;
+        return index;
+    }
+};
+
+/**
+ * Operation trace file: a header followed by `count` packed Operation
+ * records in native layout. Written by write_trace() and generate.py.
+ * Traces hold point operations only; the range strategies replay them as
+ * single-index ranges. Version 1 records were 16 bytes, with a range end.
+ */
+struct TraceHeader {
+    char magic[8];          // "FWTRACE\0"
+    unsigned version;       // 2
+    unsigned op_size;       // sizeof(Operation)
+    long long size;         // size of the tree the trace was recorded for
+    unsigned long long count;
+};
+
+constexpr char trace_magic[8] = {'F', 'W', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr unsigned trace_version = 2;
+
+inline bool valid_trace_header(const TraceHeader &header) {
+    return std::equal(header.magic, header.magic + 8, trace_magic)
+        && header.version == trace_version
+        && header.op_size == sizeof(Operation);
+}
+
+inline bool write_trace(const std::string &path, long long size, const std::vector<Operation> &operations) {
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    TraceHeader header = {};
+    std::copy(trace_magic, trace_magic + 8, header.magic);
+    header.version = trace_version;
+    header.op_size = sizeof(Operation);
+    header.size = size;
+    header.count = operations.size();
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(operations.data(), sizeof(Operation), operations.size(), file) == operations.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// Read a whole trace into memory, returns false on I/O errors or a foreign format
+inline bool read_trace(const std::string &path, TraceHeader &header, std::vector<Operation> &operations) {
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 && valid_trace_header(header);
+    if (ok) {
+        operations.resize(header.count);
+        ok = std::fread(operations.data(), sizeof(Operation), operations.size(), file) == operations.size();
+    }
+    std::fclose(file);
+    return ok;
+}
+
 class Generator {
   private:
     std::mt19937 rng;
     int size;
     int query_percentage;
+    int range_percentage;
+    std::shared_ptr<IndexDistribution> index_dist;
+
+    // Replayed in a loop instead of drawing operations when set
+    std::shared_ptr<const std::vector<Operation>> trace;
+    size_t trace_pos = 0;
 
   public:
-    Generator(int size, int query_percentage=20, unsigned int seed = std::random_device{}())
-        : size(size), query_percentage(query_percentage) {
+    Generator(int size, int query_percentage=20, unsigned int seed = std::random_device{}(), int range_percentage=0)
+        : size(size), query_percentage(query_percentage), range_percentage(range_percentage),
+          index_dist(std::make_shared<UniformIndex>(size)) {
         rng = std::mt19937(seed);
     }
 
+    /**
+     * Select the workload from a spec:
+     *   uniform                      (default)
+     *   zipf:<s>                     Zipf with exponent s > 0
+     *   hotspot:<fraction>:<prob>    `prob` of the draws hit a random region of `fraction` of the keys
+     *   sequential[:<stride>]        strided sweep over the keys
+     *   trace:<file>                 replay a binary trace, indices wrapped into [0, size)
+     * Returns false on a malformed spec or an unreadable trace.
+     */
+    bool setWorkload(const std::string &spec) {
+        auto colon = spec.find(':');
+        std::string kind = spec.substr(0, colon);
+        std::string args = colon == std::string::npos ? "" : spec.substr(colon + 1);
+
+        try {
+            if (kind == "uniform") {
+                index_dist = std::make_shared<UniformIndex>(size);
+            } else if (kind == "zipf") {
+                double s = std::stod(args);
+                if (s <= 0) {
+                    return false;
+                }
+                index_dist = std::make_shared<ZipfIndex>(size, s);
+            } else if (kind == "hotspot") {
+                auto second = args.find(':');
+                double fraction = std::stod(args.substr(0, second));
+                double probability = second == std::string::npos ? 0.9 : std::stod(args.substr(second + 1));
+                if (fraction <= 0 || fraction > 1 || probability < 0 || probability > 1) {
+                    return false;
+                }
+                int hot_size = std::max(1, (int)(fraction * size));
+                int hot_begin = std::uniform_int_distribution<int>(0, size - hot_size)(rng);
+                index_dist = std::make_shared<HotspotIndex>(size, fraction, probability, hot_begin);
+            } else if (kind == "sequential") {
+                int stride = args.empty() ? 1 : std::stoi(args);
+                if (stride <= 0) {
+                    return false;
+                }
+                index_dist = std::make_shared<SequentialIndex>(size, stride);
+            } else if (kind == "trace") {
+                TraceHeader header;
+                auto operations = std::make_shared<std::vector<Operation>>();
+                if (!read_trace(args, header, *operations) || operations->empty()) {
+                    return false;
+                }
+                for (auto &op : *operations) {
+                    op.index = (int)((unsigned)op.index % (unsigned)size);
+                }
+                trace = operations;
+                trace_pos = 0;
+            } else {
+                return false;
+            }
+        } catch (const std::logic_error &) {
+            return false;
+        }
+        return true;
+    }
+
+    // The next point operation; the share of range updates only applies to nextRange()
     Operation next() {
+        RangeOperation op = draw(0);
+        return {op.command, op.index, op.value};
+    }
+
+    // The next operation of a range strategy, a range update ('r') in `range_percentage` of the draws
+    RangeOperation nextRange() {
+        return draw(range_percentage);
+    }
+
+  private:
+    RangeOperation draw(int range_percentage) {
+        if (trace) {
+            Operation op = (*trace)[trace_pos];
+            trace_pos = trace_pos + 1 == trace->size() ? 0 : trace_pos + 1;
+            return widen(op);
+        }
+
         std::uniform_int_distribution<int> op_dist(1, 1000);             // For operation type
-        std::uniform_int_distribution<int> index_dist(0, size - 1);     // For index
         std::uniform_int_distribution<int> value_dist(1, 100);          // For value
 
-        Operation op;
+        RangeOperation op = {};
 
-        if (op_dist(rng) <= query_percentage) {
+        int op_type = op_dist(rng);
+        if (op_type <= query_percentage) {
             op.command = 'q'; // Query
+        } else if (op_type <= query_percentage + range_percentage) {
+            op.command = 'r'; // Range add
         } else {
             op.command = 'a'; // Add
         }
 
-        op.index = index_dist(rng);
-        
-        if (op.command == 'a') {
+        op.index = index_dist->next(rng);
+        op.right = op.index;
+
+        if (op.command == 'r') {
+            op.right = index_dist->next(rng);
+            if (op.right < op.index) {
+                std::swap(op.index, op.right);
+            }
+        }
+
+        if (op.command != 'q') {
             op.value = value_dist(rng);
         }
 
@@ -44,4 +336,4 @@ class Generator {
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,358 @@
+/**
+ * Self-tuning tree behind the `auto` strategy. All engines share the
+ * nodes of one model-parallel aggregate tree, so each run of updates
+ * between two queries can go to a different one:
+ *
+ *     sequential      one thread walks every update path
+ *     model-parallel  every thread walks the paths within its own range
+ *     aggregated      the same after sorting and merging duplicate indices
+ *     dense           every thread scatters into its deltas and folds its range
+ *
+ * and each run of queries is answered by sequential sums or by the
+ * model-parallel batchSum(). A run is profiled by its length and its
+ * distinct indices, estimated by linear counting, and sent to the engine
+ * with the least predicted time under a linear cost model
+ *     seconds = c0 + c1 * updates + c2 * distinct
+ * per engine, fitted at startup on the tree itself for its size and
+ * thread count. Calibration applies every synthetic batch and then its
+ * negation, so the tree ends where it started. The models are kept in a
+ * text file, one line per size and thread count.
+ */
+#ifndef HYBRID_H
+#define HYBRID_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "fenwick.h"
+#include "generator.h"
+
+enum HybridEngine { engine_sequential, engine_model_parallel, engine_aggregated, engine_dense, num_engines };
+
+inline const char *engine_name(int engine) {
+    static const char *names[num_engines] = {"sequential", "model-parallel", "aggregated", "dense"};
+    return names[engine];
+}
+
+struct HybridCostModel {
+    long long size = 0;
+    int threads = 0;
+    double update[num_engines][3] = {};  // c0, c1 per update, c2 per distinct index
+    double query_sequential = 0;         // per query
+    double query_parallel[2] = {};       // c0, c1 per query
+
+    double predict(int engine, size_t updates, size_t distinct) const {
+        return update[engine][0] + update[engine][1] * updates + update[engine][2] * distinct;
+    }
+
+    int choose(size_t updates, size_t distinct) const {
+        int best = engine_sequential;
+        for (int engine = 1; engine != num_engines; ++engine) {
+            if (predict(engine, updates, distinct) < predict(best, updates, distinct)) {
+                best = engine;
+            }
+        }
+        return best;
+    }
+
+    bool parallelQueries(size_t queries) const {
+        return query_parallel[0] + query_parallel[1] * queries < query_sequential * queries;
+    }
+};
+
+// The model for `size` and `threads` from the last matching line of `path`, false if there is none
+inline bool load_cost_model(const std::string &path, long long size, int threads, HybridCostModel &model) {
+    std::ifstream in(path);
+    bool found = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        HybridCostModel entry;
+        fields >> entry.size >> entry.threads;
+        for (auto &coefficients : entry.update) {
+            fields >> coefficients[0] >> coefficients[1] >> coefficients[2];
+        }
+        fields >> entry.query_sequential >> entry.query_parallel[0] >> entry.query_parallel[1];
+        if (fields && entry.size == size && entry.threads == threads) {
+            model = entry;
+            found = true;
+        }
+    }
+    return found;
+}
+
+inline bool save_cost_model(const std::string &path, const HybridCostModel &model) {
+    const bool exists = std::ifstream(path).good();
+    std::ofstream out(path, std::ios::app);
+    if (!exists) {
+        out << "# size threads, then c0 c1 c2 of sequential model-parallel aggregated dense, "
+            << "then the query costs: sequential, parallel c0 c1 (seconds)\n";
+    }
+    out << model.size << ' ' << model.threads;
+    for (const auto &coefficients : model.update) {
+        out << ' ' << coefficients[0] << ' ' << coefficients[1] << ' ' << coefficients[2];
+    }
+    out << ' ' << model.query_sequential << ' ' << model.query_parallel[0] << ' ' << model.query_parallel[1] << '\n';
+    return (bool)out;
+}
+
+template <typename T = int, typename Index = int>
+class FenwickTreeHybrid {
+  private:
+    using Tree = FenwickTreeModelParallelAggregate<T, Index>;
+
+    Tree tree;
+    HybridCostModel model;
+    int num_threads;
+
+    // A bit per hash bucket of the indices, for linear counting
+    std::vector<unsigned long long> seen;
+
+    std::vector<Index> query_indices;
+    std::vector<T> query_results;
+
+    unsigned long long runs[num_engines] = {};
+    unsigned long long updates[num_engines] = {};
+    unsigned long long query_runs[2] = {};
+
+    static constexpr size_t counting_bits = 1 << 16;
+
+    void apply(int engine, Span<const Operation> operations) {
+        if (engine == engine_sequential) {
+            for (const auto &operation : operations) {
+                tree.add(operation.index, operation.value);
+            }
+            return;
+        }
+        tree.setPreprocess(engine == engine_aggregated);
+        tree.setDenseDensity(engine == engine_dense ? 0.0 : std::numeric_limits<double>::infinity());
+        tree.batchAdd(operations);
+    }
+
+    // Seconds of the fastest of three runs of `operations` through `engine`, each undone afterwards
+    double measure(int engine, std::vector<Operation> &operations) {
+        double best = 1e30;
+        for (int repetition = 0; repetition < 3; ++repetition) {
+            auto start_time = std::chrono::steady_clock::now();
+            apply(engine, operations);
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+
+            for (auto &operation : operations) {
+                operation.value = -operation.value;
+            }
+            apply(engine, operations);
+            for (auto &operation : operations) {
+                operation.value = -operation.value;
+            }
+        }
+        return best;
+    }
+
+  public:
+    FenwickTreeHybrid(Index n, int num_threads) :
+        tree(n, num_threads),
+        num_threads(num_threads),
+        seen(counting_bits / 64) {}
+
+    Index size() const {
+        return tree.size();
+    }
+
+    T sum(Index x) const {
+        return tree.sum(x);
+    }
+
+    // Fold kernel of the dense engine, see FenwickTreeModelParallelAggregate
+    bool setFoldKernel(const std::string &name) {
+        return tree.setFoldKernel(name);
+    }
+
+    const HybridCostModel &costModel() const {
+        return model;
+    }
+
+    void setCostModel(const HybridCostModel &calibrated) {
+        model = calibrated;
+    }
+
+    /**
+     * Fit the cost model on this tree: a small and a large uniform run per
+     * engine, a large run over 64 hot indices for the aggregated engine,
+     * and two query runs.
+     */
+    void calibrate() {
+        const Index n = tree.size();
+        const size_t small = 64;
+        const size_t large = 65536;
+        const size_t hot = std::min<size_t>(64, n);
+        std::mt19937 rng(15618);
+
+        // Updates drawn from `pool` random indices, all of them if it is n
+        auto make = [&](size_t count, size_t pool) {
+            std::vector<int> candidates(pool);
+            for (size_t i = 0; i != pool; ++i) {
+                candidates[i] = pool == (size_t)n ? (int)i : (int)(rng() % n);
+            }
+            std::vector<Operation> operations(count);
+            for (auto &operation : operations) {
+                operation.command = 'a';
+                operation.index = candidates[rng() % pool];
+                operation.value = (int)(rng() % 100) + 1;
+            }
+            return operations;
+        };
+        auto uniform_small = make(small, n);
+        auto uniform_large = make(large, n);
+        auto hot_large = make(large, hot);
+        const double d1 = estimateDistinct(uniform_small);
+        const double d2 = estimateDistinct(uniform_large);
+        const double d3 = estimateDistinct(hot_large);
+
+        // Only the aggregated engine walks once per distinct index; for the others the hot run would mostly measure its cache hits
+        model = {};
+        model.size = n;
+        model.threads = num_threads;
+        for (int engine = 0; engine != num_engines; ++engine) {
+            const size_t folds = tree.denseBatches();
+            const double t1 = measure(engine, uniform_small);
+            const double t2 = measure(engine, uniform_large);
+            auto &c = model.update[engine];
+            if (engine == engine_aggregated && d2 > d3) {
+                const double t3 = measure(engine, hot_large);
+                c[2] = std::max(0.0, (t2 - t3) / (d2 - d3));
+            }
+            c[1] = std::max(0.0, (t2 - t1 - c[2] * (d2 - d1)) / double(large - small));
+            c[0] = std::max(0.0, t1 - c[1] * small - c[2] * d1);
+
+            // Runs of many times n updates must still be timed on the engine they are fitted for
+            const bool folded = tree.denseBatches() != folds;
+            if (folded != (engine == engine_dense)) {
+                std::cerr << "Calibration of the " << engine_name(engine) << " engine "
+                          << (folded ? "took" : "skipped") << " the dense fold" << std::endl;
+            }
+        }
+
+        std::vector<Index> indices(large);
+        std::vector<T> results(large);
+        for (auto &index : indices) {
+            index = rng() % n;
+        }
+        auto time_queries = [&](size_t count, bool parallel) {
+            double best = 1e30;
+            for (int repetition = 0; repetition < 3; ++repetition) {
+                auto start_time = std::chrono::steady_clock::now();
+                if (parallel) {
+                    tree.batchSum(indices.data(), results.data(), count);
+                } else {
+                    tree.FenwickTree<T, Index>::batchSum(indices.data(), results.data(), count);
+                }
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+            }
+            return best;
+        };
+        model.query_sequential = time_queries(large, false) / large;
+        const double q1 = time_queries(small, true);
+        const double q2 = time_queries(large, true);
+        model.query_parallel[1] = std::max(0.0, (q2 - q1) / double(large - small));
+        model.query_parallel[0] = std::max(0.0, q1 - model.query_parallel[1] * small);
+    }
+
+    // Load the model for this size and thread count from `path`, or calibrate and append it; false if it cannot be saved
+    bool calibrate(const std::string &path) {
+        if (load_cost_model(path, tree.size(), num_threads, model)) {
+            return true;
+        }
+        calibrate();
+        return save_cost_model(path, model);
+    }
+
+    // Distinct indices of the updates by linear counting over 2^16 buckets, exact enough up to a few times that
+    size_t estimateDistinct(Span<const Operation> operations) {
+        if (operations.size() < 64) {
+            return operations.size();
+        }
+        std::fill(seen.begin(), seen.end(), 0);
+        for (const auto &operation : operations) {
+            const unsigned long long bucket = ((unsigned long long)operation.index * 0x9E3779B97F4A7C15ULL) >> 48;
+            seen[bucket >> 6] |= 1ULL << (bucket & 63);
+        }
+        size_t set = 0;
+        for (auto word : seen) {
+            set += __builtin_popcountll(word);
+        }
+        if (set == counting_bits) {
+            return operations.size();
+        }
+        const double estimate = -double(counting_bits) * std::log(1.0 - double(set) / counting_bits);
+        return std::min(operations.size(), (size_t)std::llround(estimate));
+    }
+
+    // Apply a batch of updates and queries in order, returns the sum of the query answers
+    T batch(Span<const Operation> operations) {
+        T res = T(0);
+        size_t left = 0;
+        while (left < operations.size()) {
+            size_t right = left;
+            if (operations[left].command == 'q') {
+                query_indices.clear();
+                for (; right < operations.size() && operations[right].command == 'q'; ++right) {
+                    query_indices.push_back(operations[right].index);
+                }
+                query_results.resize(query_indices.size());
+                const bool parallel = model.parallelQueries(query_indices.size());
+                if (parallel) {
+                    tree.batchSum(query_indices.data(), query_results.data(), query_indices.size());
+                } else {
+                    tree.FenwickTree<T, Index>::batchSum(query_indices.data(), query_results.data(), query_indices.size());
+                }
+                ++query_runs[parallel];
+                for (T result : query_results) {
+                    res += result;
+                }
+            } else {
+                while (right < operations.size() && operations[right].command != 'q') {
+                    ++right;
+                }
+                auto run = operations.subspan(left, right - left);
+                // The duplicates only matter if merging them could pay off even with a single distinct index
+                size_t distinct = run.size();
+                const int engine_all_distinct = model.choose(run.size(), distinct);
+                if (model.predict(engine_aggregated, run.size(), 0) < model.predict(engine_all_distinct, run.size(), distinct)) {
+                    distinct = estimateDistinct(run);
+                }
+                const int engine = model.choose(run.size(), distinct);
+                apply(engine, run);
+                ++runs[engine];
+                updates[engine] += run.size();
+            }
+            left = right;
+        }
+        return res;
+    }
+
+    // The cost model and the runs each engine took, as JSON
+    void statistics(std::ostream &out = std::cerr) const {
+        out << "{\n  \"size\": " << model.size << ",\n  \"threads\": " << model.threads << ",\n  \"engines\": [";
+        for (int engine = 0; engine != num_engines; ++engine) {
+            out << (engine ? "," : "") << "\n    {\"name\": \"" << engine_name(engine) << "\", \"cost\": ["
+                << model.update[engine][0] << ", " << model.update[engine][1] << ", " << model.update[engine][2]
+                << "], \"runs\": " << runs[engine] << ", \"updates\": " << updates[engine] << "}";
+        }
+        out << "\n  ],\n  \"query_runs\": {\"sequential\": " << query_runs[0] << ", \"parallel\": " << query_runs[1]
+            << "}\n}\n";
+    }
+};
+
+#endif
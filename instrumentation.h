@@ -0,0 +1,113 @@
+/**
+ * Runtime-switchable per-thread instrumentation of the model-parallel
+ * batches. When disabled a batch pays a single branch per thread; when
+ * enabled it records the busy time of each thread, the time it waits at
+ * the closing barrier for the slowest thread, and the number of node
+ * writes in its range.
+ */
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <algorithm>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include <omp.h>
+
+// One cache line per thread so the counters do not false-share
+struct alignas(64) ThreadCounters {
+    double busy_time = 0;
+    double barrier_wait = 0;
+    unsigned long long node_writes = 0;
+    unsigned long long batches = 0;
+};
+
+class Instrumentation {
+  private:
+    bool on = false;
+    std::vector<ThreadCounters> counters;
+
+  public:
+    explicit Instrumentation(int num_threads = 0) : counters(num_threads) {}
+
+    bool enabled() const {
+        return on;
+    }
+
+    void enable(bool enable) {
+        on = enable;
+    }
+
+    void reset() {
+        std::fill(counters.begin(), counters.end(), ThreadCounters());
+    }
+
+    ThreadCounters &operator[](int t) {
+        return counters[t];
+    }
+
+    const ThreadCounters &operator[](int t) const {
+        return counters[t];
+    }
+
+    int threads() const {
+        return (int)counters.size();
+    }
+
+    // Max over mean of the per-thread busy time, 1 is perfectly balanced
+    double imbalance() const {
+        double max_time = 0;
+        double total_time = 0;
+        for (const auto &c : counters) {
+            max_time = std::max(max_time, c.busy_time);
+            total_time += c.busy_time;
+        }
+        return total_time > 0 ? max_time * counters.size() / total_time : 1.0;
+    }
+
+    // JSON report, `ranges[t]` is the node range [first, second) of thread t
+    template <typename Index>
+    void writeJson(std::ostream &out, const std::vector<std::pair<Index, Index>> &ranges) const {
+        out << "{\n  \"threads\": " << counters.size()
+            << ",\n  \"imbalance\": " << imbalance()
+            << ",\n  \"per_thread\": [";
+        for (size_t t = 0; t != counters.size(); ++t) {
+            const auto &c = counters[t];
+            out << (t ? ",\n" : "\n")
+                << "    {\"thread\": " << t
+                << ", \"lower\": " << ranges[t].first
+                << ", \"upper\": " << ranges[t].second
+                << ", \"batches\": " << c.batches
+                << ", \"busy_seconds\": " << c.busy_time
+                << ", \"barrier_wait_seconds\": " << c.barrier_wait
+                << ", \"node_writes\": " << c.node_writes << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+/**
+ * Run the per-thread part of a batch inside a parallel region. work(count)
+ * applies it and, if `count` is set, returns its node writes.
+ * When enabled, the closing barrier is made explicit to measure the wait
+ * for the slowest thread. Must be called by every thread of the team.
+ */
+template <typename F>
+void instrumented_batch(Instrumentation &stats, int t, F &&work) {
+    if (!stats.enabled()) {
+        work(false);
+        return;
+    }
+
+    auto &counters = stats[t];
+    double start_time = omp_get_wtime();
+    counters.node_writes += work(true);
+    double end_time = omp_get_wtime();
+
+    #pragma omp barrier
+    counters.busy_time += end_time - start_time;
+    counters.barrier_wait += omp_get_wtime() - end_time;
+    ++counters.batches;
+}
+
+#endif
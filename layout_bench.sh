@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+
+# Set script to stop if any command fails
+set -e
+
+# Display each command line
+set -x
+
+# Compile
+make clean
+make
+
+echo "Running Fenwick Tree benchmark with the flat layout..."
+./fenwick -t sequential -s 4095 -b 262144 -n 1000
+./fenwick -t sequential -s 2097151 -b 262144 -n 400
+./fenwick -t sequential -s 16777215 -b 262144 -n 100
+
+echo "Running Fenwick Tree benchmark with the blocked layout..."
+./fenwick -t blocked -s 4095 -b 262144 -n 1000
+./fenwick -t blocked -s 2097151 -b 262144 -n 400
+./fenwick -t blocked -s 16777215 -b 262144 -n 100
+
+echo "Run complete."
@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+
+# Set script to stop if any command fails
+set -e
+
+# Display each command line
+set -x
+
+# Compile
+make clean
+make
+
+echo "Running Fenwick Tree benchmark with lazy-combine (relaxed atomics only)..."
+for p in 2 4 8 16 32 64; do
+    ./fenwick -t lazy-combine -k 0 -p $p -s 16777215 -b 262144 -n 100
+done
+
+echo "Running Fenwick Tree benchmark with lazy-combine (top levels combined per thread)..."
+for k in 8 12; do
+    for p in 2 4 8 16 32 64; do
+        ./fenwick -t lazy-combine -k $k -p $p -s 16777215 -b 262144 -n 100
+    done
+done
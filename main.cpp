@@ -1,11 +1,20 @@
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <numeric>
+#include <thread>
 #include <unistd.h>
 
 #include "fenwick.h"
+#include "fenwick_range.h"
+#include "fenwick_nd.h"
+#include "hybrid.h"
+#include "benchmark.h"
+#include "trace.h"
 #include "task_scheduler.h"
 #include "generator.h"
 
@@ -17,35 +26,234 @@ void print_help(int argc, char *argv[]) {
               << "  -b <size>         Batch size (default: 65536)\n"
               << "  -n <count>        Number of batches (default: 1024)\n"
               << "  -s <size>         Total size of data (default: 1048575 = 2^10 - 1)\n"
+              << "  -q <permille>     Share of prefix queries in the generated batches, in 1/1000 (default: 0)\n"
+              << "  -g <workload>     Index distribution of the operations (default: uniform):\n"
+              << "                    uniform, zipf:<s>, hotspot:<fraction>:<prob>, sequential[:<stride>],\n"
+              << "                    trace:<file> (replay a binary trace)\n"
+              << "  -w <file>         Record -n batches of -b generated operations as a binary trace and exit\n"
+              << "  -f <file>         Replay a binary trace through the strategy, memory-mapped and in\n"
+              << "                    batches of -b, instead of generating -n batches\n"
+              << "  -r <count>        Timed repetitions, each on a fresh tree (default: 3)\n"
+              << "  -u <count>        Untimed warm-up batches before every repetition (default: 2)\n"
+              << "  -o <format>       Report format: text, csv or json (default: text)\n"
+              << "  -a                Sort and aggregate each batch before the per-thread walks\n"
+              << "                    (model-parallel strategies)\n"
+              << "  -v <kernel>       Range fold of model-parallel-aggregate: auto, scalar, avx2 or avx512\n"
+              << "                    (default: auto, the widest the CPU supports)\n"
+              << "  -m <pages>        Page policy of trees of 2 MB or more: default, thp (madvise huge\n"
+              << "                    pages) or hugetlb (MAP_HUGETLB, thp if none are reserved)\n"
+              << "  -x <file>         Snapshot file of the checkpoint comparison (default: fenwick.snapshot)\n"
+              << "  -e <readers>      Reader threads of the readers comparison, querying during batchAdd (default: 2)\n"
+              << "  -z <file>         Cost model calibration of the auto strategy, measured once per size and\n"
+              << "                    thread count and kept in the file (default: fenwick.calibration)\n"
+              << "  -i <event>        Count instructions, LLC misses, dTLB misses and cache-line transfers\n"
+              << "                    of the timed batches per thread with perf_event_open; <event> is the\n"
+              << "                    raw code of transfers, default for MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM\n"
+              << "                    (0x04d2, Intel Skylake and later)\n"
+              << "  -j <file>         Write per-thread busy time, barrier wait, node writes and the\n"
+              << "                    imbalance ratio as JSON (model-parallel strategies, - for stdout);\n"
+              << "                    the chunks stolen per worker for work_stealing_scheduler\n"
+              << "  -l <stripes>      Number of lock stripes of the lowest levels (lock strategies, default: 1024)\n"
+              << "  -k <levels>       Top tree levels combined per thread before one flush per batch\n"
+              << "                    (lazy-combine, default: 8, 0 = relaxed atomics only)\n"
+              << "  -c <tasks>        Tasks handed to a scheduler worker per queue operation, per stolen\n"
+              << "                    chunk, or per merge of snapshot_scheduler and async_scheduler\n"
+              << "                    (default: 256, 1 = every task)\n"
               << "\n"
               << "Strategies:\n"
-              << "  sequential, lock, model-parallel-fixed-size, model-parallel-access-aware, \n"
-              << "  model-parallel-semi-static, model-parallel-aggregate, lazy, \n"
-              << "  central_scheduler, lockfree_scheduler, pure_parallel, \n"
-              << "  query_percentage_lazy, query_percentage_pure\n"
+              << "  auto (-z), sequential, sequential-fixed (-s 2^k - 1), blocked, lock, ticket-lock, \n"
+              << "  model-parallel-fixed-size, model-parallel-access-aware, model-parallel-semi-static, \n"
+              << "  model-parallel-aggregate, lazy, lazy-combine, range, range-sequential, \n"
+              << "  range-lazy, central_scheduler, lockfree_scheduler, work_stealing_scheduler, \n"
+              << "  snapshot_scheduler, async_scheduler, pure_parallel, pure_parallel_pool\n"
+              << "\n"
+              << "Comparisons (every tree on the same batches, not registered benchmarks):\n"
+              << "  batch_sum, lower_bound, checkpoint (-x), readers (-e), grid\n"
               << "\n"
               << "Examples:\n"
               << "  " << argv[0] << " -t model-parallel-fixed-size -p 4 -b 8192 -n 512 -s 2097152\n"
-              << "  " << argv[0] << " -t model-parallel-access-aware -p 8 -b 8192 -n 2048 -s 2097152\n";
+              << "  " << argv[0] << " -t model-parallel-access-aware -p 8 -b 8192 -n 2048 -s 2097152 -o csv\n"
+              << "  " << argv[0] << " -t model-parallel-semi-static -p 8 -g zipf:0.99 -s 2097152\n"
+              << "  " << argv[0] << " -t lazy -p 8 -q 50 -r 5 -o json\n";
     
     exit(1);  // Exit with error code
 }
 
-std::unique_ptr<FenwickTreeBase> CreateFenwickTree(const std::string& type, int n, size_t num_threads) {
-    if (type == "sequential") {
-        return std::make_unique<FenwickTreeSequential>(n);
+// Apply a batch with point add/sum calls in order, returns the sum of the query answers
+template <typename Tree>
+int apply_in_order(Tree &fenwick_tree, Span<const Operation> operations) {
+    int res = 0;
+    for (const auto& op : operations) {
+        if (op.command == 'a') {
+            fenwick_tree.add(op.index, op.value);
+        } else {
+            res += fenwick_tree.sum(op.index);
+        }
+    }
+    return res;
+}
+
+// Apply a batch with concurrent add/sum calls, for the trees with thread-safe point operations
+template <typename Tree>
+void apply_concurrent(Tree &fenwick_tree, Span<const Operation> operations) {
+    #pragma omp parallel for
+    for (size_t i = 0; i < operations.size(); ++i) {
+        const auto& op = operations[i];
+        if (op.command == 'a') {
+            fenwick_tree.add(op.index, op.value);
+        } else {
+            fenwick_tree.sum(op.index);
+        }
+    }
+}
+
+// Lazy sync: the updates between two queries run concurrently, returns the sum of the query answers
+int apply_lazy(FenwickTreeLSync<> &fenwick_tree, Span<const Operation> operations,
+               std::vector<int> &query_indices, std::vector<int> &query_results) {
+    int res = 0;
+    size_t left = 0;
+    for (size_t right = 0; right < operations.size(); right++) {
+        if (operations[right].command == 'q') {
+            #pragma omp parallel for
+            for (size_t i = left; i < right; i++) {
+                fenwick_tree.add(operations[i].index, operations[i].value);
+            }
+
+            // Consecutive queries see the same state and are answered together
+            query_indices.clear();
+            for (; right < operations.size() && operations[right].command == 'q'; right++) {
+                query_indices.push_back(operations[right].index);
+            }
+            query_results.resize(query_indices.size());
+            fenwick_tree.batchSum(query_indices.data(), query_results.data(), query_indices.size());
+            for (int result : query_results) {
+                res += result;
+            }
+            left = right--;
+        }
     }
-    if (type == "lock") {
-        return std::make_unique<FenwickTreeLocked>(n);
+    #pragma omp parallel for
+    for (size_t i = left; i < operations.size(); i++) {
+        fenwick_tree.add(operations[i].index, operations[i].value);
     }
-    if (type == "model-parallel") {
-        omp_set_num_threads(num_threads);
-        return std::make_unique<FenwickTreeModelParallel>(n, omp_get_max_threads());
+    return res;
+}
+
+// Runner over a tree owned by the runner, which can be probed with sum()
+template <typename Tree>
+BenchmarkRunner tree_runner(std::shared_ptr<Tree> fenwick_tree, std::function<int(Tree &, Span<const Operation>)> apply,
+                            bool answers_queries) {
+    BenchmarkRunner runner;
+    runner.batch = [fenwick_tree, apply](Span<const Operation> operations) {
+        return apply(*fenwick_tree, operations);
+    };
+    runner.answers_queries = answers_queries;
+    runner.sum = [fenwick_tree](int x) {
+        return (long long)fenwick_tree->sum(x);
+    };
+    return runner;
+}
+
+// FenwickTreeFixed runner for n = 2^LogN - 1, searching LogN up to 24; the runner has no batch if n matches none
+template <int LogN = 1>
+BenchmarkRunner fixed_runner(int n) {
+    if constexpr (LogN > 24) {
+        return {};
+    } else if (n != FenwickTreeFixed<LogN>::capacity) {
+        return fixed_runner<LogN + 1>(n);
+    } else {
+        using Tree = FenwickTreeFixed<LogN>;
+        return tree_runner<Tree>(std::make_shared<Tree>(), apply_in_order<Tree>, true);
     }
-    if (type == "lazy") {
-        return std::make_unique<FenwickTreeLSync>(n);
+}
+
+// Whether the batches of Tree are range operations, as for the range trees
+template <typename Tree, typename = void>
+struct takes_range_operations : std::false_type {};
+
+template <typename Tree>
+struct takes_range_operations<Tree, std::void_t<decltype(std::declval<Tree &>().batchAdd(
+    std::declval<Span<const RangeOperation>>()))>> : std::true_type {};
+
+// Runner applying whole batches through batchAdd, which skips the queries
+template <typename Tree>
+BenchmarkRunner batch_runner(std::shared_ptr<Tree> fenwick_tree) {
+    if constexpr (takes_range_operations<Tree>::value) {
+        BenchmarkRunner runner;
+        runner.range_batch = [fenwick_tree](Span<const RangeOperation> operations) {
+            fenwick_tree->batchAdd(operations);
+            return 0;
+        };
+        runner.sum = [fenwick_tree](int x) {
+            return (long long)fenwick_tree->sum(x);
+        };
+        return runner;
+    } else {
+        return tree_runner<Tree>(fenwick_tree, [](Tree &tree, Span<const Operation> operations) {
+            tree.batchAdd(operations);
+            return 0;
+        }, false);
     }
-    throw std::invalid_argument("Unknown tree type");
+}
+
+// batch_runner that also reports the per-thread instrumentation of the tree
+template <typename Tree>
+BenchmarkRunner instrumented_runner(std::shared_ptr<Tree> fenwick_tree, bool preprocess, bool instrumentation) {
+    fenwick_tree->setPreprocess(preprocess);
+    fenwick_tree->setInstrumentation(instrumentation);
+    BenchmarkRunner runner = batch_runner(fenwick_tree);
+    runner.statistics = [fenwick_tree](std::ostream &out) {
+        fenwick_tree->statistics(out);
+    };
+    return runner;
+}
+
+// A scheduler that is shut down with its last owner
+template <typename SchedulerType>
+std::shared_ptr<SchedulerType> make_scheduler(int num_workers, int size, size_t batch_size, int chunk_size) {
+    return std::shared_ptr<SchedulerType>(new SchedulerType(num_workers, size, batch_size, chunk_size), [](SchedulerType *s) {
+        s->shutdown();
+        delete s;
+    });
+}
+
+// Runner feeding the batches to a centralized scheduler
+template <typename SchedulerType>
+BenchmarkRunner scheduler_runner(std::shared_ptr<SchedulerType> scheduler) {
+    BenchmarkRunner runner;
+    runner.batch = [scheduler](Span<const Operation> operations) {
+        scheduler->init();
+        for (size_t i = 0; i < operations.size(); ++i) {
+            const auto& op = operations[i];
+            if (op.command == 'a') {
+                scheduler->submit_update(op.index, op.value);
+            } else {
+                scheduler->submit_query(op.index, i);
+            }
+        }
+        scheduler->sync();
+        return scheduler->validate_sum();
+    };
+    runner.answers_queries = true;
+    return runner;
+}
+
+// Write a report to `path`, "-" for stdout
+void write_output(const std::string &path, const std::function<void(std::ostream &)> &report) {
+    if (path == "-") {
+        report(std::cout);
+        return;
+    }
+    std::ofstream out(path);
+    report(out);
+}
+
+// Write the instrumentation report of `tree` as JSON to `path`, "-" for stdout
+template <typename Tree>
+void write_statistics(const Tree &tree, const std::string &path) {
+    write_output(path, [&](std::ostream &out) {
+        tree.statistics(out);
+    });
 }
 
 int main(int argc, char* argv[]) {
@@ -54,9 +262,27 @@ int main(int argc, char* argv[]) {
     size_t size = (1 << 16);
     size_t batch_size = (1 << 16);
     size_t num_batches = 1024;
+    int query_percentage = 0;
+    int repetitions = 3;
+    int warmup = 2;
+    std::string format = "text";
+    bool preprocess = false;
+    int combine_levels = 8;
+    size_t num_stripes = 1024;
+    int chunk_size = TaskChunk::capacity;
+    std::string fold_kernel = "auto";
+    std::string page_policy = "default";
+    std::string stats_path;
+    std::string workload = "uniform";
+    std::string trace_path;
+    std::string record_path;
+    std::string snapshot_path = "fenwick.snapshot";
+    int num_readers = 2;
+    std::string calibration_path = "fenwick.calibration";
+    std::string transfer_event;
 
     int opt;
-    while ((opt = getopt(argc, argv, "t:p:b:n:s:h")) != -1) {
+    while ((opt = getopt(argc, argv, "t:p:b:n:s:q:g:f:w:r:u:o:k:l:c:v:m:x:e:z:i:j:ah")) != -1) {
         switch (opt) {
             case 't':
                 strategy = optarg;
@@ -73,548 +299,686 @@ int main(int argc, char* argv[]) {
             case 's':
                 size = std::stoi(optarg);
                 break;
+            case 'q':
+                query_percentage = std::stoi(optarg);
+                break;
+            case 'g':
+                workload = optarg;
+                break;
+            case 'f':
+                trace_path = optarg;
+                break;
+            case 'w':
+                record_path = optarg;
+                break;
+            case 'r':
+                repetitions = std::stoi(optarg);
+                break;
+            case 'u':
+                warmup = std::stoi(optarg);
+                break;
+            case 'o':
+                format = optarg;
+                break;
+            case 'i':
+                transfer_event = optarg;
+                break;
+            case 'j':
+                stats_path = optarg;
+                break;
+            case 'l':
+                num_stripes = std::stoul(optarg);
+                break;
+            case 'k':
+                combine_levels = std::stoi(optarg);
+                break;
+            case 'c':
+                chunk_size = std::stoi(optarg);
+                break;
+            case 'v':
+                fold_kernel = optarg;
+                break;
+            case 'm':
+                page_policy = optarg;
+                break;
+            case 'x':
+                snapshot_path = optarg;
+                break;
+            case 'e':
+                num_readers = std::stoi(optarg);
+                break;
+            case 'z':
+                calibration_path = optarg;
+                break;
+            case 'a':
+                preprocess = true;
+                break;
             case 'h':
             default:
                 print_help(argc, argv);
         }
     }
+    if (format != "text" && format != "csv" && format != "json") {
+        print_help(argc, argv);
+    }
+    // FenwickTreeFixed is instantiated for the sizes 2^k - 1 up to 2^24 - 1
+    if (strategy == "sequential-fixed" && (size == 0 || size > (1 << 24) - 1 || (size & (size + 1)) != 0)) {
+        std::cerr << "sequential-fixed needs -s 2^k - 1, at most 16777215" << std::endl;
+        return -1;
+    }
+    // The scheduler strategies submit from this thread and hand the tasks to -p - 1 workers
+    const std::vector<std::string> scheduler_strategies = {"central_scheduler", "lockfree_scheduler", "work_stealing_scheduler",
+                                                           "snapshot_scheduler", "async_scheduler"};
+    if (num_threads < 2 && std::find(scheduler_strategies.begin(), scheduler_strategies.end(), strategy) != scheduler_strategies.end()) {
+        std::cerr << strategy << " needs -p 2 or more: one submitting thread and at least one worker" << std::endl;
+        return -1;
+    }
+    if (!find_fold_kernel(fold_kernel)) {
+        std::cerr << "Unsupported fold kernel: " << fold_kernel << std::endl;
+        print_help(argc, argv);
+    }
+    unsigned long long transfer_code = default_transfer_event;
+    if (!transfer_event.empty() && transfer_event != "default") {
+        char *end = nullptr;
+        transfer_code = std::strtoull(transfer_event.c_str(), &end, 0);
+        if (*end != '\0') {
+            std::cerr << "Invalid raw event: " << transfer_event << std::endl;
+            print_help(argc, argv);
+        }
+    }
+    if (!parse_page_policy(page_policy, tree_page_policy())) {
+        std::cerr << "Unknown page policy: " << page_policy << std::endl;
+        print_help(argc, argv);
+    }
 
     omp_set_num_threads(num_threads);
     size_t num_operations = batch_size * num_batches;
     
-    Generator generator(size, 0, 15618);
-    std::vector<Operation> operations(batch_size);
-
-    // Run sequential version
-    if (strategy == "sequential") {
-        FenwickTreeSequential fenwick_tree(size);
+    // Every strategy draws its operations through here, so -g applies to all of them
+    auto make_generator = [&](int generator_size, int q_percentage, unsigned int seed, int r_percentage) {
+        Generator result(generator_size, q_percentage, seed, r_percentage);
+        if (!result.setWorkload(workload)) {
+            std::cerr << "Invalid workload: " << workload << std::endl;
+            print_help(argc, argv);
+        }
+        return result;
+    };
 
-        std::chrono::microseconds generating_duration(0);
-        auto start_time = std::chrono::steady_clock::now();
+    Generator generator = make_generator(size, query_percentage, 15618, 0);
+    std::vector<Operation> operations(batch_size);
 
-        for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            auto generating_start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+    if (!record_path.empty()) {
+        TraceWriter writer(record_path, size);
+        bool written = writer.ok();
+        for (size_t batch_start = 0; batch_start < num_operations && written; batch_start += batch_size) {
+            for (auto& operation : operations) {
+                operation = generator.next();
             }
-            auto generating_end_time = std::chrono::steady_clock::now();
-            generating_duration += std::chrono::duration_cast<std::chrono::microseconds>(
-                generating_end_time - generating_start_time
-            );
+            written = writer.append(operations);
+        }
+        if (!writer.close() || !written) {
+            std::cerr << "Cannot write trace: " << record_path << std::endl;
+            return -1;
+        }
+        std::cout << "Recorded " << num_operations << " operations to " << record_path << std::endl;
+        return 0;
+    }
 
-            // fenwick_tree.batchAdd(operations);
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    fenwick_tree.add(op.index, op.value);
+    int max_threads = omp_get_max_threads();
+    bool instrumentation = !stats_path.empty();
+    std::vector<int> query_indices;
+    std::vector<int> query_results;
+
+    BenchmarkRegistry registry;
+    // Dispatches every run of updates or queries to the engine its calibrated cost model predicts fastest
+    registry.add("auto", [&](int n) {
+        using Tree = FenwickTreeHybrid<>;
+        auto tree = std::make_shared<Tree>(n, max_threads);
+        tree->setFoldKernel(fold_kernel);
+        if (!tree->calibrate(calibration_path)) {
+            std::cerr << "Cannot save the calibration to " << calibration_path << std::endl;
+        }
+        BenchmarkRunner runner = tree_runner<Tree>(tree, [](Tree &tree, Span<const Operation> ops) {
+            return tree.batch(ops);
+        }, true);
+        runner.statistics = [tree](std::ostream &out) {
+            tree->statistics(out);
+        };
+        return runner;
+    });
+    registry.add("sequential", [&](int n) {
+        return tree_runner<FenwickTreeSequential<>>(std::make_shared<FenwickTreeSequential<>>(n),
+                                                    apply_in_order<FenwickTreeSequential<>>, true);
+    });
+    registry.add("sequential-fixed", [&](int n) {
+        return fixed_runner(n);
+    });
+    registry.add("blocked", [&](int n) {
+        return tree_runner<FenwickTreeBlocked<>>(std::make_shared<FenwickTreeBlocked<>>(n),
+                                                 apply_in_order<FenwickTreeBlocked<>>, true);
+    });
+    registry.add("lock", [&](int n) {
+        using Tree = FenwickTreeLocked<>;
+        return tree_runner<Tree>(std::make_shared<Tree>(n, num_stripes), [](Tree &tree, Span<const Operation> ops) {
+            apply_concurrent(tree, ops);
+            return 0;
+        }, false);
+    });
+    registry.add("ticket-lock", [&](int n) {
+        using Tree = FenwickTreeLocked<int, int, Plus<int>, TicketLock>;
+        return tree_runner<Tree>(std::make_shared<Tree>(n, num_stripes), [](Tree &tree, Span<const Operation> ops) {
+            apply_concurrent(tree, ops);
+            return 0;
+        }, false);
+    });
+    registry.add("model-parallel-fixed-size", [&](int n) {
+        return instrumented_runner(std::make_shared<FenwickTreeModelParallel<>>(n, max_threads), preprocess, instrumentation);
+    });
+    registry.add("model-parallel-access-aware", [&](int n) {
+        return instrumented_runner(std::make_shared<FenwickTreeModelParallelAccessAware<>>(n, max_threads), preprocess, instrumentation);
+    });
+    registry.add("model-parallel-semi-static", [&](int n) {
+        return instrumented_runner(std::make_shared<FenwickTreeModelParallelSemiStatic<>>(n, max_threads), preprocess, instrumentation);
+    });
+    registry.add("model-parallel-aggregate", [&](int n) {
+        auto tree = std::make_shared<FenwickTreeModelParallelAggregate<>>(n, max_threads);
+        tree->setFoldKernel(fold_kernel);
+        return instrumented_runner(tree, preprocess, instrumentation);
+    });
+    registry.add("lazy", [&](int n) {
+        using Tree = FenwickTreeLSync<>;
+        return tree_runner<Tree>(std::make_shared<Tree>(n), [&](Tree &tree, Span<const Operation> ops) {
+            return apply_lazy(tree, ops, query_indices, query_results);
+        }, true);
+    });
+    registry.add("lazy-combine", [&](int n) {
+        return batch_runner(std::make_shared<FenwickTreeLCombine<>>(n, max_threads, combine_levels));
+    });
+    // Half of the updates of the range strategies cover a whole range [l, r]
+    registry.add("range", [&](int n) {
+        return instrumented_runner(std::make_shared<FenwickTreeRangeModelParallel<>>(n, max_threads), preprocess, instrumentation);
+    }, 500);
+    registry.add("range-sequential", [&](int n) {
+        return batch_runner(std::make_shared<FenwickTreeRangeSequential<>>(n));
+    }, 500);
+    registry.add("range-lazy", [&](int n) {
+        return batch_runner(std::make_shared<FenwickTreeRangeLSync<>>(n));
+    }, 500);
+    // The scheduling thread only distributes tasks, -p counts it
+    registry.add("central_scheduler", [&](int n) {
+        return scheduler_runner(make_scheduler<Scheduler>(num_threads - 1, n, batch_size, chunk_size));
+    });
+    registry.add("lockfree_scheduler", [&](int n) {
+        return scheduler_runner(make_scheduler<LockFreeScheduler>(num_threads - 1, n, batch_size, chunk_size));
+    });
+    registry.add("work_stealing_scheduler", [&](int n) {
+        auto scheduler = make_scheduler<WorkStealingScheduler>(num_threads - 1, n, batch_size, chunk_size);
+        BenchmarkRunner runner = scheduler_runner(scheduler);
+        runner.statistics = [scheduler](std::ostream &out) {
+            auto steals = scheduler->steals();
+            out << "{\n  \"threads\": " << steals.size() << ",\n  \"steals\": [";
+            for (size_t t = 0; t != steals.size(); ++t) {
+                out << (t ? ", " : "") << steals[t];
+            }
+            out << "]\n}\n";
+        };
+        return runner;
+    });
+    registry.add("snapshot_scheduler", [&](int n) {
+        return scheduler_runner(make_scheduler<SnapshotScheduler>(num_threads - 1, n, batch_size, chunk_size));
+    });
+    registry.add("async_scheduler", [&](int n) {
+        std::shared_ptr<AsyncScheduler> scheduler(new AsyncScheduler(num_threads - 1, n, chunk_size), [](AsyncScheduler *s) {
+            s->shutdown();
+            delete s;
+        });
+        auto answers = std::make_shared<std::vector<int>>();
+        BenchmarkRunner runner;
+        runner.batch = [scheduler, answers](Span<const Operation> ops) {
+            answers->assign(ops.size(), 0);
+            for (size_t i = 0; i < ops.size(); ++i) {
+                if (ops[i].command == 'a') {
+                    scheduler->submit_add(ops[i].index, ops[i].value);
                 } else {
-                    int result = fenwick_tree.sum(op.index);
+                    int *answer = &(*answers)[i];
+                    scheduler->submit_query(ops[i].index, [answer](int result) { *answer = result; });
                 }
             }
+            scheduler->drain();
+            int res = 0;
+            for (int answer : *answers) {
+                res += answer;
+            }
+            return res;
+        };
+        runner.answers_queries = true;
+        runner.sum = [scheduler](int x) {
+            return (long long)scheduler->sum(x);
+        };
+        return runner;
+    });
+    registry.add("pure_parallel", [&](int n) {
+        auto local_trees = std::make_shared<std::vector<FenwickTreeSequential<>>>();
+        local_trees->reserve(num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            local_trees->emplace_back(n, Uninitialized());
         }
-        
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-        
-        std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Total execution time: " << duration.count() << " microseconds" << std::endl;
-        std::cout << "Total data generating time: " << generating_duration.count() << " microseconds" << std::endl;
-        std::cout << "Total computation time: " << (duration - generating_duration).count() << " microseconds" << std::endl;
-        std::cout << "Batch computation time: " << (duration - generating_duration).count() / num_batches << " microseconds" << std::endl;
-        std::cout << "Average time per operation: " << (duration.count() / num_operations) << " microseconds" << std::endl;
-        std::cout << std::endl;
 
-    } else if (strategy == "lock") {
-        FenwickTreeLocked fenwick_tree(size);
-        auto start_time = std::chrono::steady_clock::now();
-        
-        std::chrono::microseconds generating_duration(0);
-        // Only parallelize if we have enough operations
-        for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            auto generating_start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+        // Tree i is first-touched on the CPU its worker is pinned to
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+        for (size_t i = 0; i < num_threads; ++i) {
+            ScopedPin pin(worker_cpu(i));
+            (*local_trees)[i].clearWithin(0, n + 1);
+        }
+        BenchmarkRunner runner;
+        runner.batch = [local_trees, &num_threads](Span<const Operation> ops) {
+            DecentralizedScheduler scheduler(num_threads - 1, ops.size(), ops, *local_trees);
+            scheduler.sync();
+            return scheduler.validate_sum();
+        };
+        runner.answers_queries = true;
+        return runner;
+    });
+    registry.add("pure_parallel_pool", [&](int n) {
+        std::shared_ptr<DecentralizedPool> pool(new DecentralizedPool(num_threads - 1, n, batch_size), [](DecentralizedPool *p) {
+            p->shutdown();
+            delete p;
+        });
+        BenchmarkRunner runner;
+        runner.batch = [pool](Span<const Operation> ops) {
+            pool->submit_batch(ops);
+            pool->sync();
+            return pool->validate_sum();
+        };
+        runner.answers_queries = true;
+        return runner;
+    });
+
+    if (const BenchmarkStrategy *registered = registry.find(strategy)) {
+        BenchmarkConfig config;
+        config.strategy = strategy;
+        config.size = size;
+        config.threads = num_threads;
+        config.batch_size = batch_size;
+        config.warmup = warmup;
+        config.repetitions = repetitions;
+        config.workload = trace_path.empty() ? workload : "file:" + trace_path;
+        config.query_percentage = query_percentage;
+        config.preprocess = preprocess;
+        config.combine_levels = combine_levels;
+        config.stripes = num_stripes;
+        config.counters = !transfer_event.empty();
+        config.transfer_event = transfer_code;
+
+        std::unique_ptr<MappedTrace> trace;
+        std::unique_ptr<BatchSource> source;
+        if (!trace_path.empty()) {
+            trace = std::make_unique<MappedTrace>(trace_path);
+            if (!trace->ok()) {
+                std::cerr << "Cannot map trace: " << trace_path << std::endl;
+                return -1;
             }
-            auto generating_end_time = std::chrono::steady_clock::now();
-            generating_duration += std::chrono::duration_cast<std::chrono::microseconds>(
-                generating_end_time - generating_start_time
-            );
+            // The trace is trusted to hold indices below the size it was recorded for
+            config.size = (int)trace->treeSize();
+            source = std::make_unique<TraceBatches>(*trace, batch_size);
+        } else {
+            int range_percentage = registered->range_percentage;
+            source = std::make_unique<GeneratedBatches>([&, range_percentage]() {
+                return make_generator(size, query_percentage, 15618, range_percentage);
+            }, batch_size, num_batches);
+        }
 
-            #pragma omp parallel for
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    fenwick_tree.add(op.index, op.value);
-                } else {
-                    int result = fenwick_tree.sum(op.index);
-                }
-            }
+        BenchmarkResult result;
+        BenchmarkRunner runner;
+        if (!run_benchmark(*registered, config, *source, result, runner)) {
+            return -1;
         }
-        
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-        
-        std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Total execution time: " << duration.count() << " microseconds" << std::endl;
-        std::cout << "Total data generating time: " << generating_duration.count() << " microseconds" << std::endl;
-        std::cout << "Total computation time: " << (duration - generating_duration).count() << " microseconds" << std::endl;
-        std::cout << "Batch computation time: " << (duration - generating_duration).count() / num_batches << " microseconds" << std::endl;
-        std::cout << "Average time per operation: " << (duration.count() / num_operations) << " microseconds" << std::endl;
-        std::cout << std::endl;
 
-    } else if (strategy == "model-parallel-fixed-size") {
-        FenwickTreeModelParallel fenwick_tree(size, omp_get_max_threads());
+        if (format == "csv") {
+            write_result_csv_header(std::cout);
+            write_result_csv(std::cout, result);
+        } else if (format == "json") {
+            write_result_json(std::cout, result);
+        } else {
+            write_result_text(std::cout, result);
+        }
 
-        std::chrono::microseconds generating_duration(0);
-        auto start_time = std::chrono::steady_clock::now();
+        if (!stats_path.empty() && runner.statistics) {
+            write_output(stats_path, runner.statistics);
+        }
+        return 0;
+    }
 
-        for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            auto generating_start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
-            }
-            auto generating_end_time = std::chrono::steady_clock::now();
-            generating_duration += std::chrono::duration_cast<std::chrono::microseconds>(
-                generating_end_time - generating_start_time
-            );
+    if (!trace_path.empty()) {
+        std::cerr << "Strategy " << strategy << " cannot replay a trace" << std::endl;
+        return -1;
+    }
+
+    if (strategy == "batch_sum") {
+        FenwickTreeSequential<> base_tree(size);
+        FenwickTreeModelParallelAccessAware<> model_tree(size, omp_get_max_threads());
 
-            fenwick_tree.batchAdd(operations);
+        // Start both trees from the same random snapshot
+        std::vector<int> values(size);
+        for (auto& value : values) {
+            value = generator.next().value;
         }
-        
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+        base_tree.build(values.data(), size);
+        model_tree.build(values.data(), size);
 
-        std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Total execution time: " << duration.count() << " microseconds" << std::endl;
-        std::cout << "Total data generating time: " << generating_duration.count() << " microseconds" << std::endl;
-        std::cout << "Total computation time: " << (duration - generating_duration).count() << " microseconds" << std::endl;
-        std::cout << "Batch computation time: " << (duration - generating_duration).count() / num_batches << " microseconds" << std::endl;
-        std::cout << "Average time per operation: " << (duration.count() / num_operations) << " microseconds" << std::endl;
-        std::cout << std::endl;
-    } else if (strategy == "model-parallel-access-aware") {
-        FenwickTreeModelParallelAccessAware fenwick_tree(size, omp_get_max_threads());
+        std::vector<int> seq_results(batch_size);
+        std::vector<int> sorted_results(batch_size);
+        std::vector<int> model_results(batch_size);
+        query_indices.resize(batch_size);
 
-        std::chrono::microseconds generating_duration(0);
-        auto start_time = std::chrono::steady_clock::now();
+        double sequential_time = 0;
+        double sorted_time = 0;
+        double model_time = 0;
 
         for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            auto generating_start_time = std::chrono::steady_clock::now();
             for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+                query_indices[i] = generator.next().index;
             }
-            auto generating_end_time = std::chrono::steady_clock::now();
-            generating_duration += std::chrono::duration_cast<std::chrono::microseconds>(
-                generating_end_time - generating_start_time
-            );
 
-            fenwick_tree.batchAdd(operations);
-        }
-        
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+            auto start_time = std::chrono::steady_clock::now();
+            base_tree.batchSum(query_indices.data(), seq_results.data(), batch_size);
+            sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
-        std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Total execution time: " << duration.count() << " microseconds" << std::endl;
-        std::cout << "Total data generating time: " << generating_duration.count() << " microseconds" << std::endl;
-        std::cout << "Total computation time: " << (duration - generating_duration).count() << " microseconds" << std::endl;
-        std::cout << "Batch computation time: " << (duration - generating_duration).count() / num_batches << " microseconds" << std::endl;
-        std::cout << "Average time per operation: " << (duration.count() / num_operations) << " microseconds" << std::endl;
-        std::cout << std::endl;
-    } else if (strategy == "model-parallel-semi-static") {
-        FenwickTreeModelParallelSemiStatic fenwick_tree(size, omp_get_max_threads());
+            start_time = std::chrono::steady_clock::now();
+            base_tree.batchSumParallel(query_indices.data(), sorted_results.data(), batch_size);
+            sorted_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
-        std::chrono::microseconds generating_duration(0);
-        auto start_time = std::chrono::steady_clock::now();
+            start_time = std::chrono::steady_clock::now();
+            model_tree.batchSum(query_indices.data(), model_results.data(), batch_size);
+            model_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
-        for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            auto generating_start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+            if (seq_results != sorted_results || seq_results != model_results) {
+                std::cout << "output diff at batch: " << batch_start << std::endl;
+                return -1;
             }
-            auto generating_end_time = std::chrono::steady_clock::now();
-            generating_duration += std::chrono::duration_cast<std::chrono::microseconds>(
-                generating_end_time - generating_start_time
-            );
-
-            fenwick_tree.batchAdd(operations);
         }
-        
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
 
         std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Total execution time: " << duration.count() << " microseconds" << std::endl;
-        std::cout << "Total data generating time: " << generating_duration.count() << " microseconds" << std::endl;
-        std::cout << "Total computation time: " << (duration - generating_duration).count() << " microseconds" << std::endl;
-        std::cout << "Batch computation time: " << (duration - generating_duration).count() / num_batches << " microseconds" << std::endl;
-        std::cout << "Average time per operation: " << (duration.count() / num_operations) << " microseconds" << std::endl;
+        std::cout << "Total queries: " << num_operations << std::endl;
+        std::cout << "Seq time: " << sequential_time << " seconds" << std::endl;
+        std::cout << "Sorted Parallel time: " << sorted_time << " seconds" << std::endl;
+        std::cout << "Model-Parallel time: " << model_time << " seconds" << std::endl;
+        std::cout << "Sorted Parallel Speedup: " << sequential_time / sorted_time << "x" << std::endl;
+        std::cout << "Model-Parallel Speedup: " << sequential_time / model_time << "x" << std::endl;
         std::cout << std::endl;
-    } else if (strategy == "model-parallel-aggregate") {
-        FenwickTreeModelParallelAggregate fenwick_tree(size, omp_get_max_threads());
+    } else if (strategy == "lower_bound") {
+        // Every batch of updates is followed by a batch of searches for uniform keys in [1, total]
+        FenwickTreeSequential<long long> base_tree(size);
+        FenwickTreeModelParallelAccessAware<long long> model_tree(size, omp_get_max_threads());
+        std::mt19937_64 key_rng(15618);
 
-        std::chrono::microseconds generating_duration(0);
-        auto start_time = std::chrono::steady_clock::now();
+        std::vector<long long> keys(batch_size);
+        std::vector<int> bisect_results(batch_size);
+        std::vector<int> lifting_results(batch_size);
+        std::vector<int> batch_results(batch_size);
+
+        double bisect_time = 0;
+        double lifting_time = 0;
+        double batch_time = 0;
 
         for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            auto generating_start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+            for (auto& operation : operations) {
+                operation = generator.next();
+                operation.command = 'a';
+                base_tree.add(operation.index, operation.value);
             }
-            auto generating_end_time = std::chrono::steady_clock::now();
-            generating_duration += std::chrono::duration_cast<std::chrono::microseconds>(
-                generating_end_time - generating_start_time
-            );
-
-            fenwick_tree.batchAdd(operations);
-        }
-        
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-
-        std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Total execution time: " << duration.count() << " microseconds" << std::endl;
-        std::cout << "Total data generating time: " << generating_duration.count() << " microseconds" << std::endl;
-        std::cout << "Total computation time: " << (duration - generating_duration).count() << " microseconds" << std::endl;
-        std::cout << "Batch computation time: " << (duration - generating_duration).count() / num_batches << " microseconds" << std::endl;
-        std::cout << "Average time per operation: " << (duration.count() / num_operations) << " microseconds" << std::endl;
-        std::cout << std::endl;
-    }  else if (strategy == "lazy")  {
-        omp_set_num_threads(num_threads);
-        std::string base_strategy = "sequential";
-        std::unique_ptr<FenwickTreeBase> base_tree = CreateFenwickTree(base_strategy, size, num_threads);
-        std::unique_ptr<FenwickTreeBase> test_tree = CreateFenwickTree(strategy, size, num_threads);
-        double test_time = 0;
-        double sequential_time = 0;
-        auto start_time = std::chrono::steady_clock::now();
+            model_tree.batchAdd(operations);
 
-        for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            int seq_res = 0;
-            int test_res = 0;
+            std::uniform_int_distribution<long long> key_dist(1, base_tree.sum(size - 1));
+            for (auto& key : keys) {
+                key = key_dist(key_rng);
+            }
 
+            // Binary search over sum(), O(log^2 n) per search
+            auto start_time = std::chrono::steady_clock::now();
             for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+                int lo = 0, hi = size;
+                while (lo < hi) {
+                    int mid = lo + (hi - lo) / 2;
+                    if (base_tree.sum(mid) < keys[i]) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                bisect_results[i] = lo;
             }
+            bisect_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
             start_time = std::chrono::steady_clock::now();
             for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    base_tree->add(op.index, op.value);
-                } else {
-                    seq_res += base_tree->sum(op.index);
-                }
+                lifting_results[i] = base_tree.lowerBound(keys[i]);
             }
-            sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+            lifting_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
             start_time = std::chrono::steady_clock::now();
-            size_t left = 0;
-            for (size_t right = 0; right < batch_size; right++) {
-                const auto& op = operations[right];
-                if (op.command == 'q') {
-                    #pragma omp parallel for
-                    for (size_t i = left; i < right; i++) {
-                        test_tree->add(operations[i].index, operations[i].value);                        
-                    }
-                    test_res += test_tree->sum(op.index);
-                    left = right + 1;
-                }
-            }
-            #pragma omp parallel for
-            for (size_t i = left; i < batch_size; i++) {
-                test_tree->add(operations[i].index, operations[i].value);                        
-            }
-            test_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-            if (seq_res != test_res) {
-                std::cout << "output diff at batch: " << batch_start << " t: " << test_res << " s: " << seq_res << std::endl;
+            model_tree.batchLowerBound(keys.data(), batch_results.data(), batch_size);
+            batch_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+            if (bisect_results != lifting_results || bisect_results != batch_results) {
+                std::cout << "output diff at batch: " << batch_start << std::endl;
                 return -1;
             }
         }
-        
+
         std::cout << "Performance:" << std::endl;
-        std::cout << "Total operations: " << num_operations << std::endl;
-        std::cout << "Seq time: " << sequential_time << " microseconds" << std::endl;
-        std::cout << "Test Algo time: " << test_time << " microseconds" << std::endl; 
+        std::cout << "Total searches: " << num_operations << std::endl;
+        std::cout << "Binary search over sum time: " << bisect_time << " seconds" << std::endl;
+        std::cout << "Binary lifting time: " << lifting_time << " seconds" << std::endl;
+        std::cout << "Model-Parallel batch time: " << batch_time << " seconds" << std::endl;
+        std::cout << "Binary lifting Speedup: " << bisect_time / lifting_time << "x" << std::endl;
+        std::cout << "Batch Speedup: " << bisect_time / batch_time << "x" << std::endl;
         std::cout << std::endl;
-    } else if (strategy == "central_scheduler")  {
-        std::string base_strategy = "sequential";
-        std::unique_ptr<FenwickTreeBase> base_tree = CreateFenwickTree(base_strategy, size, num_threads);
-        Scheduler scheduler = Scheduler(num_threads-1, size, batch_size);
-
-        double test_time = 0;
-        double sequential_time = 0;
-        double schedule_time = 0;
-        auto start_time = std::chrono::steady_clock::now();
+    } else if (strategy == "checkpoint") {
+        // A background checkpoint starts every 16 batches if the previous one is written; batches during one are timed apart
+        const size_t checkpoint_interval = 16;
+        FenwickTreeModelParallelAccessAware<> model_tree(size, omp_get_max_threads());
+        BackgroundCheckpoint checkpoint;
+        std::vector<double> quiet_times;
+        std::vector<double> checkpoint_times;
+        double max_stall_time = 0;
+        size_t checkpoints = 0;
 
         for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            int seq_res = 0;
-            int test_res = 0;
-
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+            for (auto& operation : operations) {
+                operation = generator.next();
+                operation.command = 'a';
             }
 
-            start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    base_tree->add(op.index, op.value);
-                } else {
-                    seq_res += base_tree->sum(op.index);
+            bool in_flight = checkpoint.running();
+            if (!in_flight && batch_start / batch_size % checkpoint_interval == 0) {
+                if (checkpoints > 0 && !checkpoint.wait()) {
+                    std::cerr << "Cannot write snapshot: " << snapshot_path << std::endl;
+                    return -1;
                 }
+                auto start_time = std::chrono::steady_clock::now();
+                in_flight = checkpoint.start(model_tree.snapshot(), snapshot_path);
+                max_stall_time = std::max(max_stall_time, std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count());
+                checkpoints += in_flight;
             }
-            sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
-            scheduler.init();
-            start_time = std::chrono::steady_clock::now();  
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    scheduler.submit_update(op.index, op.value);
-                } else {
-                    scheduler.submit_query(op.index, i);
-                }
-            }
-            schedule_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count(); 
+            auto start_time = std::chrono::steady_clock::now();
+            model_tree.batchAdd(operations);
+            double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+            (in_flight ? checkpoint_times : quiet_times).push_back(seconds);
+        }
 
-            scheduler.sync();
-            test_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-            test_res = scheduler.validate_sum();
-            if (seq_res != test_res) {
-                std::cout << "output diff at batch: " << batch_start << " t: " << test_res << " s: " << seq_res << std::endl;
+        // Checkpoint the final state, even if the last one during the batches failed, and restore it into a fresh tree
+        auto start_time = std::chrono::steady_clock::now();
+        bool last_written = checkpoint.wait();
+        if (!last_written) {
+            std::cerr << "Cannot write snapshot " << checkpoints << " during the batches: " << snapshot_path << std::endl;
+        }
+        bool written = checkpoint.start(model_tree.snapshot(), snapshot_path) && checkpoint.wait();
+        double write_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+        if (!written) {
+            std::cerr << "Cannot write final snapshot: " << snapshot_path << std::endl;
+            return -1;
+        }
+
+        start_time = std::chrono::steady_clock::now();
+        FenwickTreeModelParallelAccessAware<> restored_tree(size, omp_get_max_threads());
+        MappedSnapshot snapshot(snapshot_path);
+        bool restored = snapshot.ok() && restored_tree.restore(snapshot);
+        double restore_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+        if (!restored) {
+            std::cerr << "Cannot restore snapshot: " << snapshot_path << std::endl;
+            return -1;
+        }
+        for (int x = 0; x < (int)size; ++x) {
+            if (restored_tree.sum(x) != model_tree.sum(x)) {
+                std::cout << "output diff at index: " << x << std::endl;
                 return -1;
             }
         }
-        scheduler.shutdown();
-        
+
+        double quiet_max = quiet_times.empty() ? 0 : *std::max_element(quiet_times.begin(), quiet_times.end());
+        double checkpoint_max = checkpoint_times.empty() ? 0 : *std::max_element(checkpoint_times.begin(), checkpoint_times.end());
         std::cout << "Performance:" << std::endl;
-        std::cout << "Worker threads: " << num_threads - 1 << std::endl;
-        std::cout << "Seq time: " << sequential_time << " seconds" << std::endl;
-        std::cout << "Central Scheduler time: " << test_time << " seconds" << std::endl; 
-        std::cout << "Speedup: " << sequential_time / test_time << "x" << std::endl; 
+        std::cout << "Checkpoints: " << checkpoints << " during " << quiet_times.size() + checkpoint_times.size() << " batches" << std::endl;
+        std::cout << "Checkpoint stall (max): " << max_stall_time * 1e3 << " ms" << std::endl;
+        std::cout << "Batch time without checkpoint (median / max): " << percentile(quiet_times, 0.5) * 1e3 << " / " << quiet_max * 1e3 << " ms" << std::endl;
+        std::cout << "Batch time during checkpoint (median / max): " << percentile(checkpoint_times, 0.5) * 1e3 << " / " << checkpoint_max * 1e3 << " ms" << std::endl;
+        std::cout << "Final checkpoint time: " << write_time << " seconds" << std::endl;
+        std::cout << "Restore time: " << restore_time << " seconds" << std::endl;
         std::cout << std::endl;
-    } else if (strategy == "lockfree_scheduler")  {
-        std::string base_strategy = "sequential";
-        std::unique_ptr<FenwickTreeBase> base_tree = CreateFenwickTree(base_strategy, size, num_threads);
-        LockFreeScheduler scheduler = LockFreeScheduler(num_threads-1, size, batch_size);
-
-        double test_time = 0;
-        double sequential_time = 0;
-        double schedule_time = 0;
-        auto start_time = std::chrono::steady_clock::now();
-
-        for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            int seq_res = 0;
-            int test_res = 0;
-
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+        if (!last_written) {
+            return -1;
+        }
+    } else if (strategy == "readers") {
+        // Every update adds 1, so a total that is not a multiple of the batch size saw part of a batch
+        std::vector<std::vector<Operation>> batches(num_operations / batch_size, std::vector<Operation>(batch_size));
+        for (auto& batch : batches) {
+            for (auto& operation : batch) {
+                operation = generator.next();
+                operation.command = 'a';
+                operation.value = 1;
             }
+        }
 
-            start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    base_tree->add(op.index, op.value);
-                } else {
-                    seq_res += base_tree->sum(op.index);
-                }
+        auto run = [&](auto& tree, const char* name) {
+            std::atomic<bool> writing(true);
+            std::vector<long long> reads(num_readers);
+            std::vector<long long> torn(num_readers);
+            std::vector<int> checksums(num_readers);
+            std::vector<std::thread> readers;
+            for (int r = 0; r < num_readers; ++r) {
+                readers.emplace_back([&, r] {
+                    pin_thread_to_core(Topology::get().cpu(num_threads + r));
+                    std::mt19937 rng(r);
+                    do {
+                        for (int i = 0; i < 64; ++i) {
+                            checksums[r] += tree.sum(rng() % size);
+                        }
+                        torn[r] += tree.sum(size - 1) % (int)batch_size != 0;
+                        reads[r] += 65;
+                    } while (writing.load(std::memory_order_relaxed));
+                });
             }
-            sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
-            scheduler.init();
-            start_time = std::chrono::steady_clock::now();  
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    scheduler.submit_update(op.index, op.value);
-                } else {
-                    scheduler.submit_query(op.index, i);
-                }
+            auto start_time = std::chrono::steady_clock::now();
+            for (const auto& batch : batches) {
+                tree.batchAdd(batch);
             }
-            schedule_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count(); 
-
-            scheduler.sync();
-            test_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-            test_res = scheduler.validate_sum();
-            if (seq_res != test_res) {
-                std::cout << "output diff at batch: " << batch_start << " t: " << test_res << " s: " << seq_res << std::endl;
-                return -1;
+            double write_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+            writing = false;
+            for (auto& reader : readers) {
+                reader.join();
             }
-        }
-        scheduler.shutdown();
-        
+            double read_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+            long long total_reads = std::accumulate(reads.begin(), reads.end(), 0LL);
+            long long total_torn = std::accumulate(torn.begin(), torn.end(), 0LL);
+            std::cout << name << " update throughput: " << num_operations / write_time / 1e6 << " Mops/s, read throughput: "
+                      << total_reads / read_time / 1e6 << " Mops/s, torn totals: " << total_torn << std::endl;
+            return (int)tree.sum(size - 1) == (int)(batches.size() * batch_size);
+        };
+
         std::cout << "Performance:" << std::endl;
-        std::cout << "Worker threads: " << num_threads - 1 << std::endl;
-        std::cout << "Seq time: " << sequential_time << " seconds" << std::endl;
-        std::cout << "Lockfree Scheduler time: " << test_time << " seconds" << std::endl; 
-        std::cout << "Speedup: " << sequential_time / test_time << "x" << std::endl; 
+        std::cout << "Readers: " << num_readers << ", writer threads: " << num_threads << std::endl;
+        FenwickTreeModelParallel<> model_tree(size, omp_get_max_threads());
+        FenwickTreeLWithin<> within_tree(size, omp_get_max_threads());
+        FenwickTreeVersioned<FenwickTreeModelParallel<>> versioned_tree(size, omp_get_max_threads());
+        bool ok = run(model_tree, "Model-Parallel (unsynchronized)");
+        ok = run(within_tree, "Lazy Sync Within (readers wait)") && ok;
+        ok = run(versioned_tree, "Versioned Model-Parallel") && ok;
         std::cout << std::endl;
-    } else if (strategy == "pure_parallel")  {
-        std::string base_strategy = "sequential";
-        std::unique_ptr<FenwickTreeBase> base_tree = CreateFenwickTree(base_strategy, size, num_threads);
-        std::vector<FenwickTreeSequential> local_trees;
-        local_trees.reserve(num_threads - 1);
-        for (size_t i = 0; i < num_threads; ++i) {
-            local_trees.emplace_back(FenwickTreeSequential(size));
+        if (!ok) {
+            std::cout << "output diff after the last batch" << std::endl;
+            return -1;
         }
+    } else if (strategy == "grid") {
+        // Square 2D grid with about `size` cells, e.g. -s 16777215 is 4096x4096
+        int side = (int)std::sqrt((double)size + 1);
+        generator = make_generator(side, 0, 15618, 0);
+        FenwickTreeNDSequential<int, int, 2> base_tree({side, side});
+        FenwickTreeNDSequential<int, int, 2, Plus<int>, TiledLayout<int, 2>> tiled_tree({side, side});
+        FenwickTreeNDModelParallel<int, int, 2> model_tree({side, side}, omp_get_max_threads());
+        FenwickTreeNDModelParallel<int, int, 2, Plus<int>, TiledLayout<int, 2>> model_tiled_tree({side, side}, omp_get_max_threads());
+        model_tree.setInstrumentation(!stats_path.empty());
+        std::vector<OperationND<int, int, 2>> grid_operations(batch_size);
 
-        double test_time = 0;
         double sequential_time = 0;
-        auto start_time = std::chrono::steady_clock::now();
+        double tiled_time = 0;
+        double model_time = 0;
+        double model_tiled_time = 0;
 
         for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-            int seq_res = 0;
-            int test_res = 0;
-
-            for (size_t i = 0; i < batch_size; ++i) {
-                operations[i] = generator.next();
+            for (auto& operation : grid_operations) {
+                Operation row = generator.next();
+                operation = {'a', {row.index, generator.next().index}, row.value};
             }
 
-            start_time = std::chrono::steady_clock::now();
-            for (size_t i = 0; i < batch_size; ++i) {
-                const auto& op = operations[i];
-                if (op.command == 'a') {
-                    base_tree->add(op.index, op.value);
-                } else {
-                    seq_res += base_tree->sum(op.index);
-                }
-            }
+            auto start_time = std::chrono::steady_clock::now();
+            base_tree.batchAdd(grid_operations);
             sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
 
             start_time = std::chrono::steady_clock::now();
-            DecentralizedScheduler scheduler = DecentralizedScheduler(num_threads - 1, batch_size, operations, local_trees);
-            scheduler.sync();
-            test_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-            test_res = scheduler.validate_sum();
-            if (seq_res != test_res) {
-                std::cout << "output diff at batch: " << batch_start << " t: " << test_res << " s: " << seq_res << std::endl;
-                return -1;
+            tiled_tree.batchAdd(grid_operations);
+            tiled_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+            start_time = std::chrono::steady_clock::now();
+            model_tree.batchAdd(grid_operations);
+            model_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+            start_time = std::chrono::steady_clock::now();
+            model_tiled_tree.batchAdd(grid_operations);
+            model_tiled_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
+
+            // Spot-check prefix sums at the points of this batch
+            for (size_t i = 0; i < batch_size; i += 64) {
+                const auto& point = grid_operations[i].index;
+                int expected = base_tree.sum(point);
+                if (tiled_tree.sum(point) != expected || model_tree.sum(point) != expected || model_tiled_tree.sum(point) != expected) {
+                    std::cout << "output diff at batch: " << batch_start << std::endl;
+                    return -1;
+                }
             }
         }
-        
+
         std::cout << "Performance:" << std::endl;
-        std::cout << "Num threads: " << num_threads - 1 << std::endl;
+        std::cout << "Grid: " << side << "x" << side << std::endl;
+        std::cout << "Total operations: " << num_operations << std::endl;
         std::cout << "Seq time: " << sequential_time << " seconds" << std::endl;
-        std::cout << "Pure Parallel time: " << test_time << " seconds" << std::endl;
-        std::cout << "Speedup: " << sequential_time / test_time << "x" << std::endl;
+        std::cout << "Tiled time: " << tiled_time << " seconds" << std::endl;
+        std::cout << "Model-Parallel time: " << model_time << " seconds" << std::endl;
+        std::cout << "Model-Parallel Tiled time: " << model_tiled_time << " seconds" << std::endl;
+        std::cout << "Tiled Speedup: " << sequential_time / tiled_time << "x" << std::endl;
+        std::cout << "Model-Parallel Speedup: " << sequential_time / model_time << "x" << std::endl;
+        std::cout << "Model-Parallel Tiled Speedup: " << sequential_time / model_tiled_time << "x" << std::endl;
         std::cout << std::endl;
-    } else if (strategy == "query_percentage_lazy") {
-        std::vector<int> query_percentages = {0, 1, 5, 10, 50, 100, 500, 1000};
-        for (auto q_percentage : query_percentages) {
-            generator = Generator(size, q_percentage);
-            std::string base_strategy = "sequential";
-            std::string lazy_strategy = "lazy";
-            std::unique_ptr<FenwickTreeBase> base_tree = CreateFenwickTree(base_strategy, size, num_threads);
-            std::unique_ptr<FenwickTreeBase> lazy_tree = CreateFenwickTree(lazy_strategy, size, num_threads);
-    
-            double lazy_time = 0;
-            double sequential_time = 0;
-            auto start_time = std::chrono::steady_clock::now();
-    
-            for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-                int seq_res = 0;
-                int test_res = 0;
-    
-                for (size_t i = 0; i < batch_size; ++i) {
-                    operations[i] = generator.next();
-                }
-    
-                start_time = std::chrono::steady_clock::now();
-                for (size_t i = 0; i < batch_size; ++i) {
-                    const auto& op = operations[i];
-                    if (op.command == 'a') {
-                        base_tree->add(op.index, op.value);
-                    } else {
-                        seq_res += base_tree->sum(op.index);
-                    }
-                }
-                sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-
-                start_time = std::chrono::steady_clock::now();
-                size_t left = 0;
-                for (size_t right = 0; right < batch_size; right++) {
-                    const auto& op = operations[right];
-                    if (op.command == 'q') {
-                        #pragma omp parallel for
-                        for (size_t i = left; i < right; i++) {
-                            lazy_tree->add(operations[i].index, operations[i].value);                        
-                        }
-                        test_res += lazy_tree->sum(op.index);
-                        left = right + 1;
-                    }
-                }
-                #pragma omp parallel for
-                for (size_t i = left; i < batch_size; i++) {
-                    lazy_tree->add(operations[i].index, operations[i].value);                        
-                }
-                lazy_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-            }
-            
-            std::cout << "Performance:" << std::endl;
-            std::cout << "Query Percentage: " << q_percentage / 10.0 << "%" << std::endl;
-            std::cout << "Seq time: " << sequential_time << " seconds" << std::endl;
-            std::cout << "Lazy time: " << lazy_time << " seconds" << std::endl;
-            std::cout << "Lazy Speedup: " <<  sequential_time / lazy_time<< "x" << std::endl;
-            std::cout << std::endl;
-        }
-    }  else if (strategy == "query_percentage_pure") {
-        std::vector<int> query_percentages = {0, 1, 5, 10, 50, 100, 500, 1000};
-        for (auto q_percentage : query_percentages) {
-            generator = Generator(size, q_percentage);
-            std::string base_strategy = "sequential";
-            std::unique_ptr<FenwickTreeBase> base_tree = CreateFenwickTree(base_strategy, size, num_threads);
-            std::vector<FenwickTreeSequential> local_trees;
-            local_trees.reserve(num_threads - 1);
-            for (size_t i = 0; i < num_threads; ++i) {
-                local_trees.emplace_back(FenwickTreeSequential(size));
-            }
-    
-            double parallel_time = 0;
-            double sequential_time = 0;
-            auto start_time = std::chrono::steady_clock::now();
-    
-            for (size_t batch_start = 0; batch_start < num_operations; batch_start += batch_size) {
-                int seq_res = 0;
-                int test_res = 0;
-    
-                for (size_t i = 0; i < batch_size; ++i) {
-                    operations[i] = generator.next();
-                }
-    
-                start_time = std::chrono::steady_clock::now();
-                for (size_t i = 0; i < batch_size; ++i) {
-                    const auto& op = operations[i];
-                    if (op.command == 'a') {
-                        base_tree->add(op.index, op.value);
-                    } else {
-                        seq_res += base_tree->sum(op.index);
-                    }
-                }
-                sequential_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-   
-                start_time = std::chrono::steady_clock::now();
-                DecentralizedScheduler scheduler = DecentralizedScheduler(num_threads - 1, batch_size, operations, local_trees);
-                scheduler.sync();
-                parallel_time += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_time).count();
-                test_res = scheduler.validate_sum();
-            }
-            
-            std::cout << "Performance:" << std::endl;
-            std::cout << "Query Percentage: " << q_percentage / 10.0 << "%" << std::endl;
-            std::cout << "Seq time: " << sequential_time << " seconds" << std::endl;
-            std::cout << "Para time: " << parallel_time << " seconds" << std::endl; 
-            std::cout << "Parallel Speedup: " << sequential_time / parallel_time << "x" << std::endl;
-            std::cout << std::endl;
+
+        if (!stats_path.empty()) {
+            write_statistics(model_tree, stats_path);
         }
     } else {
         print_help(argc, argv);
     }
 
     return 0;
-}
\ No newline at end of file
+}
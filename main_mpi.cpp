@@ -0,0 +1,234 @@
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <mpi.h>
+#include <omp.h>
+
+#include "fenwick.h"
+#include "fenwick_mpi.h"
+
+using Tree = FenwickTreeDistributed<long long, long long>;
+using Update = PointUpdate<long long, long long>;
+
+void print_help(char *argv[]) {
+    std::cout << "Usage: mpirun -np <ranks> " << argv[0] << " [options]\n\n"
+              << "Options:\n"
+              << "  -s <size>         Total size of data, up to 2^62 (default: 16777215 = 2^24 - 1)\n"
+              << "  -b <size>         Updates per batch: per rank (weak scaling) or in total (strong)\n"
+              << "                    (default: 262144)\n"
+              << "  -n <count>        Number of batches (default: 100)\n"
+              << "  -q <count>        Prefix queries per batch, counted like -b (default: 1024)\n"
+              << "  -p <threads>      OpenMP threads per rank (default: 1)\n"
+              << "  -m <scaling>      weak or strong (default: weak)\n"
+              << "  -u <count>        Untimed warm-up batches (default: 2)\n"
+              << "  -o <format>       Report format: text or csv (default: text)\n"
+              << "  -c                Check every answer against a sequential tree on rank 0\n"
+              << "                    (the whole tree and all operations must fit there)\n"
+              << "  -h                Show this help\n";
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+// This rank's share of `count` operations per batch
+size_t local_share(size_t count, bool weak, int rank, int num_ranks) {
+    if (weak) {
+        return count;
+    }
+    return count * (rank + 1) / num_ranks - count * rank / num_ranks;
+}
+
+// Gather the variable-length `local` of every rank on rank 0, in rank order
+template <typename Item>
+std::vector<Item> gather_on_root(const std::vector<Item> &local, int num_ranks) {
+    int bytes = int(local.size() * sizeof(Item));
+    std::vector<int> counts(num_ranks), offsets(num_ranks);
+    MPI_Gather(&bytes, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    size_t total = 0;
+    for (int r = 0; r != num_ranks; ++r) {
+        offsets[r] = (int)total;
+        total += counts[r];
+    }
+    std::vector<Item> all(total / sizeof(Item));
+    MPI_Gatherv(local.data(), bytes, MPI_BYTE, all.data(), counts.data(), offsets.data(), MPI_BYTE, 0, MPI_COMM_WORLD);
+    return all;
+}
+
+struct DistributedResult {
+    double update_seconds = 0;
+    double query_seconds = 0;
+    unsigned long long entries_sent = 0;  // this rank's, warm-up included
+    size_t mismatches = 0;                // on rank 0 with -c
+};
+
+// Run the batches on a tree of its own, destroyed before MPI_Finalize()
+DistributedResult run(long long size, size_t local_updates, size_t local_queries, size_t num_batches, size_t warmup,
+                      bool check, int rank, int num_ranks) {
+    DistributedResult result;
+    Tree tree(size);
+    std::unique_ptr<FenwickTreeSequential<long long, long long>> reference;
+    if (check && rank == 0) {
+        reference = std::make_unique<FenwickTreeSequential<long long, long long>>(size);
+    }
+
+    std::mt19937_64 rng(15618 + rank);
+    std::uniform_int_distribution<long long> index_distribution(0, size - 1);
+    std::uniform_int_distribution<long long> value_distribution(1, 100);
+    std::vector<Update> updates(local_updates);
+    std::vector<long long> queries(local_queries);
+    std::vector<long long> answers(local_queries);
+
+    for (size_t batch = 0; batch != warmup + num_batches; ++batch) {
+        for (auto &update : updates) {
+            update = {index_distribution(rng), value_distribution(rng)};
+        }
+        for (auto &query : queries) {
+            query = index_distribution(rng);
+        }
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start_time = MPI_Wtime();
+        tree.batchAdd(updates.data(), updates.size());
+        double update_time = MPI_Wtime();
+        tree.batchSum(queries.data(), answers.data(), queries.size());
+        double query_time = MPI_Wtime();
+
+        if (batch >= warmup) {
+            result.update_seconds += update_time - start_time;
+            result.query_seconds += query_time - update_time;
+        }
+
+        if (check) {
+            auto all_updates = gather_on_root(updates, num_ranks);
+            auto all_queries = gather_on_root(queries, num_ranks);
+            auto all_answers = gather_on_root(answers, num_ranks);
+            if (rank == 0) {
+                for (const auto &update : all_updates) {
+                    reference->add(update.index, update.value);
+                }
+                for (size_t i = 0; i != all_queries.size(); ++i) {
+                    if (reference->sum(all_queries[i]) != all_answers[i]) {
+                        ++result.mismatches;
+                    }
+                }
+            }
+        }
+    }
+
+    if (check) {
+        long long total = tree.sum(size - 1);
+        if (rank == 0 && total != reference->sum(size - 1)) {
+            ++result.mismatches;
+        }
+    }
+    result.entries_sent = tree.entriesSent();
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    MPI_Init(&argc, &argv);
+    int rank, num_ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+    long long size = (1 << 24) - 1;
+    size_t batch_size = 262144;
+    size_t num_batches = 100;
+    size_t num_queries = 1024;
+    int num_threads = 1;
+    std::string scaling = "weak";
+    size_t warmup = 2;
+    std::string format = "text";
+    bool check = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:n:q:p:m:u:o:ch")) != -1) {
+        switch (opt) {
+            case 's':
+                size = std::stoll(optarg);
+                break;
+            case 'b':
+                batch_size = std::stoull(optarg);
+                break;
+            case 'n':
+                num_batches = std::stoull(optarg);
+                break;
+            case 'q':
+                num_queries = std::stoull(optarg);
+                break;
+            case 'p':
+                num_threads = std::stoi(optarg);
+                break;
+            case 'm':
+                scaling = optarg;
+                break;
+            case 'u':
+                warmup = std::stoull(optarg);
+                break;
+            case 'o':
+                format = optarg;
+                break;
+            case 'c':
+                check = true;
+                break;
+            case 'h':
+            default:
+                print_help(argv);
+        }
+    }
+    if (size <= 0 || num_threads <= 0 || (scaling != "weak" && scaling != "strong")
+        || (format != "text" && format != "csv")) {
+        print_help(argv);
+    }
+    omp_set_num_threads(num_threads);
+
+    const bool weak = scaling == "weak";
+    const size_t local_updates = local_share(batch_size, weak, rank, num_ranks);
+    const size_t local_queries = local_share(num_queries, weak, rank, num_ranks);
+
+    DistributedResult result = run(size, local_updates, local_queries, num_batches, warmup, check, rank, num_ranks);
+    unsigned long long total_sent = 0;
+    MPI_Reduce(&result.entries_sent, &total_sent, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        const double updates_per_batch = weak ? double(batch_size) * num_ranks : batch_size;
+        const double queries_per_batch = weak ? double(num_queries) * num_ranks : num_queries;
+        const double update_mops = result.update_seconds > 0
+            ? updates_per_batch * num_batches / result.update_seconds / 1e6 : 0;
+        const double query_mops = result.query_seconds > 0
+            ? queries_per_batch * num_batches / result.query_seconds / 1e6 : 0;
+        const double entries_per_update = total_sent / (updates_per_batch * (warmup + num_batches));
+
+        if (format == "csv") {
+            std::cout << "ranks,threads,size,scaling,batch_size,queries,batches,update_seconds,update_mops,"
+                      << "query_seconds,query_mops,entries_per_update" << std::endl;
+            std::cout << num_ranks << ',' << num_threads << ',' << size << ',' << scaling << ','
+                      << (size_t)updates_per_batch << ',' << (size_t)queries_per_batch << ',' << num_batches << ','
+                      << result.update_seconds << ',' << update_mops << ',' << result.query_seconds << ','
+                      << query_mops << ',' << entries_per_update << std::endl;
+        } else {
+            std::cout << "Performance:" << std::endl;
+            std::cout << "Ranks: " << num_ranks << " x " << num_threads << " threads" << std::endl;
+            std::cout << "Size: " << size << ", " << scaling << " scaling" << std::endl;
+            std::cout << "Updates: " << (size_t)updates_per_batch << " x " << num_batches << " batches" << std::endl;
+            std::cout << "Update time: " << result.update_seconds << " seconds, " << update_mops << " Mops/s"
+                      << std::endl;
+            std::cout << "Queries: " << (size_t)queries_per_batch << " x " << num_batches << " batches" << std::endl;
+            std::cout << "Query time: " << result.query_seconds << " seconds, " << query_mops << " Mops/s"
+                      << std::endl;
+            std::cout << "Entries sent to other ranks per update: " << entries_per_update << std::endl;
+            std::cout << std::endl;
+        }
+        if (check) {
+            if (result.mismatches == 0) {
+                std::cout << "Validation passed" << std::endl;
+            } else {
+                std::cout << "Validation failed: " << result.mismatches << " wrong sums" << std::endl;
+            }
+        }
+    }
+
+    MPI_Finalize();
+    return result.mismatches == 0 ? 0 : 1;
+}
@@ -1,7 +1,8 @@
 #!/usr/bin/env bash
 
-# Set script to stop if any command fails
+# Set script to stop if any command fails, also within the pipes
 set -e
+set -o pipefail
 
 # Display each command line
 set -x
@@ -10,68 +11,31 @@ set -x
 make clean
 make
 
-echo "Running Fenwick Tree benchmark with model-parallel-fixed-size..."
-./fenwick -t model-parallel-fixed-size -p 2 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-fixed-size -p 3 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-fixed-size -p 5 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-fixed-size -p 8 -s 4095 -b 262144 -n 1000
-
-./fenwick -t model-parallel-fixed-size -p 2 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-fixed-size -p 3 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-fixed-size -p 5 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-fixed-size -p 8 -s 2097151 -b 262144 -n 400
-
-./fenwick -t model-parallel-fixed-size -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-fixed-size -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-fixed-size -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-fixed-size -p 8 -s 16777215 -b 262144 -n 100
-
-echo "Running Fenwick Tree benchmark with model-parallel-access-aware..."
-./fenwick -t model-parallel-access-aware -p 2 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-access-aware -p 3 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-access-aware -p 5 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-access-aware -p 8 -s 4095 -b 262144 -n 1000
-
-./fenwick -t model-parallel-access-aware -p 2 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-access-aware -p 3 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-access-aware -p 5 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-access-aware -p 8 -s 2097151 -b 262144 -n 400
-
-./fenwick -t model-parallel-access-aware -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-access-aware -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-access-aware -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-access-aware -p 8 -s 16777215 -b 262144 -n 100
-
-echo "Running Fenwick Tree benchmark with model-parallel-semi-static..."
-./fenwick -t model-parallel-semi-static -p 2 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-semi-static -p 3 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-semi-static -p 5 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-semi-static -p 8 -s 4095 -b 262144 -n 1000
-
-./fenwick -t model-parallel-semi-static -p 2 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-semi-static -p 3 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-semi-static -p 5 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-semi-static -p 8 -s 2097151 -b 262144 -n 400
-
-./fenwick -t model-parallel-semi-static -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-semi-static -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-semi-static -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-semi-static -p 8 -s 16777215 -b 262144 -n 100
-
-echo "Running Fenwick Tree benchmark with model-parallel-aggregate..."
-./fenwick -t model-parallel-aggregate -p 2 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-aggregate -p 3 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-aggregate -p 5 -s 4095 -b 262144 -n 1000
-./fenwick -t model-parallel-aggregate -p 8 -s 4095 -b 262144 -n 1000
-
-./fenwick -t model-parallel-aggregate -p 2 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-aggregate -p 3 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-aggregate -p 5 -s 2097151 -b 262144 -n 400
-./fenwick -t model-parallel-aggregate -p 8 -s 2097151 -b 262144 -n 400
-
-./fenwick -t model-parallel-aggregate -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-aggregate -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-aggregate -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t model-parallel-aggregate -p 8 -s 16777215 -b 262144 -n 100
-
-echo "Run complete."
\ No newline at end of file
+# One CSV row per run, for regression tracking
+OUT=${OUT:-model_parallel_bench.csv}
+: > "$OUT"
+
+# COUNTERS=default, or the raw event code of cache-line transfers, fills the hardware event columns (-i)
+COUNTERS=${COUNTERS:-}
+
+run() {
+    ./fenwick -o csv ${COUNTERS:+-i "$COUNTERS"} "$@" | { read -r header; [ -s "$OUT" ] || echo "$header" >> "$OUT"; cat >> "$OUT"; }
+}
+
+for strategy in model-parallel-fixed-size model-parallel-access-aware model-parallel-semi-static model-parallel-aggregate; do
+    echo "Running Fenwick Tree benchmark with $strategy..."
+    for p in 2 3 5 8; do
+        run -t $strategy -p $p -s 4095 -b 262144 -n 1000
+        run -t $strategy -p $p -s 2097151 -b 262144 -n 400
+        run -t $strategy -p $p -s 16777215 -b 262144 -n 100
+    done
+done
+
+echo "Running Fenwick Tree benchmark with model-parallel-access-aware and sort-and-aggregate preprocessing..."
+for p in 2 3 5 8; do
+    run -t model-parallel-access-aware -a -p $p -s 4095 -b 262144 -n 1000
+    run -t model-parallel-access-aware -a -p $p -s 2097151 -b 262144 -n 400
+    run -t model-parallel-access-aware -a -p $p -s 16777215 -b 262144 -n 100
+done
+
+echo "Run complete, results in $OUT."
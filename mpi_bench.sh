@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+
+# Set script to stop if any command fails, also within the pipes
+set -e
+set -o pipefail
+
+# Display each command line
+set -x
+
+# Compile
+make clean
+make fenwick_mpi
+
+# One CSV row per run, for regression tracking; MPIRUN may add a hostfile for several nodes
+OUT=${OUT:-mpi_bench.csv}
+MPIRUN=${MPIRUN:-mpirun}
+: > "$OUT"
+
+run() {
+    local ranks=$1
+    shift
+    $MPIRUN -np "$ranks" ./fenwick_mpi -o csv "$@" | { read -r header; [ -s "$OUT" ] || echo "$header" >> "$OUT"; cat >> "$OUT"; }
+}
+
+echo "Running weak scaling, 2^24 nodes and 262144 updates per rank..."
+for ranks in 1 2 4 8 16; do
+    run $ranks -m weak -s $((ranks * 16777216 - 1)) -b 262144 -n 100
+done
+
+echo "Running strong scaling, 2^30 nodes and 4194304 updates per batch..."
+for ranks in 1 2 4 8 16; do
+    run $ranks -m strong -s 1073741823 -b 4194304 -n 20
+done
+
+echo "Run complete, results in $OUT."
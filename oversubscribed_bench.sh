@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+
+# Set script to stop if any command fails, also within the pipes
+set -e
+set -o pipefail
+
+# Display each command line
+set -x
+
+# Compile
+make clean
+make
+
+# One CSV row per run, for regression tracking
+OUT=${OUT:-oversubscribed_bench.csv}
+: > "$OUT"
+
+run() {
+    ./fenwick -o csv "$@" | { read -r header; [ -s "$OUT" ] || echo "$header" >> "$OUT"; cat >> "$OUT"; }
+}
+
+CORES=$(nproc)
+HOGS=()
+
+# Busy loops pinned to every other worker core, so those workers keep getting preempted
+start_hogs() {
+    for ((core = 1; core < CORES; core += 2)); do
+        taskset -c $core sh -c 'while :; do :; done' &
+        HOGS+=($!)
+    done
+}
+
+stop_hogs() {
+    if [ ${#HOGS[@]} -gt 0 ]; then
+        kill "${HOGS[@]}" 2>/dev/null || true
+        wait "${HOGS[@]}" 2>/dev/null || true
+    fi
+    HOGS=()
+}
+trap stop_hogs EXIT
+
+echo "Running the schedulers with one worker per core, twice as many workers, and contended cores..."
+for strategy in central_scheduler lockfree_scheduler work_stealing_scheduler; do
+    run -t $strategy -p $CORES -s 2097151 -b 262144 -n 100
+    run -t $strategy -p $((2 * CORES)) -s 2097151 -b 262144 -n 100
+    start_hogs
+    run -t $strategy -p $CORES -s 2097151 -b 262144 -n 100
+    stop_hogs
+done
+
+echo "Run complete, results in $OUT."
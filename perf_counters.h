@@ -0,0 +1,222 @@
+/**
+ * Hardware event counters of the timed batches, from perf_event_open. One
+ * counter per event is opened on every thread of the process when the
+ * timed batches begin, so the OpenMP team and the scheduler workers, all
+ * started during warm-up, are counted each on its own; threads started
+ * later are not. The counters only run between enable() and disable()
+ * around each batch and are scaled by time enabled over time running when
+ * the PMU multiplexes them. An event the CPU, the kernel or
+ * perf_event_paranoid does not allow is reported once and left uncounted,
+ * which in a VM without a virtual PMU is all of them.
+ *
+ * Cache-line transfers have no generic perf event. They are counted as
+ * loads that hit a line modified in another core's cache (HITM snoops),
+ * a model-specific raw event: MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM by default,
+ * 0x04d2 on Intel Skylake and later, or any raw code given with -i.
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum PerfEvent {
+    perf_instructions,
+    perf_llc_misses,
+    perf_dtlb_load_misses,
+    perf_dtlb_store_misses,
+    perf_line_transfers,
+    num_perf_events
+};
+
+inline const char *perf_event_name(int event) {
+    static const char *names[num_perf_events] = {
+        "instructions", "llc_misses", "dtlb_load_misses", "dtlb_store_misses", "line_transfers"};
+    return names[event];
+}
+
+// MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM, event 0xd2 umask 0x04
+constexpr unsigned long long default_transfer_event = 0x04d2;
+
+// Counts of one thread, -1 for events that were not counted
+struct PerfCounts {
+    double values[num_perf_events];
+
+    PerfCounts() {
+        std::fill(values, values + num_perf_events, -1.0);
+    }
+
+    bool counted(int event) const {
+        return values[event] >= 0;
+    }
+
+    void accumulate(const PerfCounts &other) {
+        for (int event = 0; event != num_perf_events; ++event) {
+            if (other.counted(event)) {
+                values[event] = std::max(values[event], 0.0) + other.values[event];
+            }
+        }
+    }
+};
+
+// Add the per-thread counts of `other` to `into`, matching the threads by position
+inline void accumulate_counts(std::vector<PerfCounts> &into, const std::vector<PerfCounts> &other) {
+    into.resize(std::max(into.size(), other.size()));
+    for (size_t t = 0; t != other.size(); ++t) {
+        into[t].accumulate(other[t]);
+    }
+}
+
+// Sum of the counts of all threads
+inline PerfCounts total_counts(const std::vector<PerfCounts> &counts) {
+    PerfCounts total;
+    for (const auto &thread : counts) {
+        total.accumulate(thread);
+    }
+    return total;
+}
+
+class PerfCounters {
+  private:
+    struct Task {
+        int fds[num_perf_events];
+    };
+
+    unsigned long long transfer_event;
+    std::vector<Task> tasks;
+
+    perf_event_attr attributes(int event) const {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        auto cache_miss = [](unsigned long long cache, unsigned long long op) {
+            return cache | (op << 8) | ((unsigned long long)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        switch (event) {
+            case perf_instructions:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case perf_llc_misses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case perf_dtlb_load_misses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ);
+                break;
+            case perf_dtlb_store_misses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE);
+                break;
+            case perf_line_transfers:
+                attr.type = PERF_TYPE_RAW;
+                attr.config = transfer_event;
+                break;
+        }
+        return attr;
+    }
+
+    template <typename F>
+    void forEachFd(F &&f) {
+        for (auto &task : tasks) {
+            for (int fd : task.fds) {
+                if (fd >= 0) {
+                    f(fd);
+                }
+            }
+        }
+    }
+
+  public:
+    explicit PerfCounters(unsigned long long transfer_event = default_transfer_event)
+        : transfer_event(transfer_event) {}
+
+    ~PerfCounters() {
+        close();
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // Open the stopped counters on every thread of the process, in thread id order
+    void open() {
+        close();
+        std::vector<pid_t> tids;
+        if (DIR *dir = opendir("/proc/self/task")) {
+            while (dirent *entry = readdir(dir)) {
+                if (entry->d_name[0] != '.') {
+                    tids.push_back((pid_t)std::stol(entry->d_name));
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(tids.begin(), tids.end());
+
+        static bool warned[num_perf_events] = {};
+        for (pid_t tid : tids) {
+            Task task;
+            for (int event = 0; event != num_perf_events; ++event) {
+                perf_event_attr attr = attributes(event);
+                task.fds[event] = (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+                if (task.fds[event] < 0 && !warned[event]) {
+                    warned[event] = true;
+                    std::cerr << "perf_event_open(" << perf_event_name(event) << "): " << std::strerror(errno)
+                              << ", not counted" << std::endl;
+                }
+            }
+            tasks.push_back(task);
+        }
+    }
+
+    void enable() {
+        forEachFd([](int fd) {
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        });
+    }
+
+    void disable() {
+        forEachFd([](int fd) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        });
+    }
+
+    // Counts since open() per thread, scaled for multiplexing
+    std::vector<PerfCounts> read() const {
+        std::vector<PerfCounts> counts(tasks.size());
+        for (size_t t = 0; t != tasks.size(); ++t) {
+            for (int event = 0; event != num_perf_events; ++event) {
+                unsigned long long data[3];  // value, time enabled, time running
+                const int fd = tasks[t].fds[event];
+                if (fd >= 0 && ::read(fd, data, sizeof(data)) == (ssize_t)sizeof(data)) {
+                    counts[t].values[event] = data[2] > 0 ? (double)data[0] * data[1] / data[2] : 0;
+                }
+            }
+        }
+        return counts;
+    }
+
+    void close() {
+        forEachFd([](int fd) {
+            ::close(fd);
+        });
+        tasks.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,318 @@
+/**
+ * Snapshots of tree state. A tree describes its raw node arrays (and the
+ * node ranges of the model-parallel trees) in a SnapshotView, which
+ * write_snapshot() stores as a versioned binary file:
+ *
+ *     SnapshotHeader
+ *     SnapshotArray[num_arrays]      count, node size and file offset
+ *     {long long, long long}[num_ranges]
+ *     the node arrays, each starting on a 64-byte boundary
+ *
+ * Restoring maps the file read-only and copies every array straight into
+ * the tree's own nodes, there is nothing to parse. A snapshot is only
+ * valid for a tree of the same class, size and value type, which restore()
+ * checks against the array counts and node sizes.
+ *
+ * BackgroundCheckpoint takes a consistent copy of the nodes between two
+ * batches and writes it from a thread of its own while the batches go on.
+ * The batch after start() only waits for the copy. Forking for a
+ * copy-on-write image instead made that batch pay a page fault and a page
+ * copy for every page it updated, which for uniform updates is the whole
+ * tree at fault speed, several times the cost of one plain copy.
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tree_allocator.h"
+
+struct SnapshotHeader {
+    char magic[8];              // "FWSNAP\0\0"
+    unsigned version;           // 1
+    unsigned num_arrays;
+    unsigned long long num_ranges;
+};
+
+struct SnapshotArray {
+    unsigned long long count;
+    unsigned long long node_size;
+    unsigned long long offset;  // from the start of the file
+};
+
+constexpr char snapshot_magic[8] = {'F', 'W', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr unsigned snapshot_version = 1;
+constexpr size_t snapshot_max_arrays = 4;
+constexpr size_t snapshot_alignment = 64;
+
+// What a tree stores in its snapshot; the arrays point into the live tree
+struct SnapshotView {
+    struct Array {
+        const void *data;
+        size_t count;
+        size_t node_size;
+    };
+
+    Array arrays[snapshot_max_arrays] = {};
+    unsigned num_arrays = 0;
+    std::vector<std::pair<long long, long long>> ranges;
+
+    template <typename T>
+    void add(const T *data, size_t count) {
+        arrays[num_arrays++] = {data, count, sizeof(T)};
+    }
+
+    // Append the arrays of another tree, for trees made of several
+    void append(const SnapshotView &other) {
+        for (unsigned i = 0; i != other.num_arrays; ++i) {
+            arrays[num_arrays++] = other.arrays[i];
+        }
+    }
+
+    template <typename Index>
+    void setRanges(const std::vector<std::pair<Index, Index>> &tree_ranges) {
+        ranges.assign(tree_ranges.begin(), tree_ranges.end());
+    }
+};
+
+inline bool write_all(int fd, const void *data, size_t bytes) {
+    const char *p = static_cast<const char *>(data);
+    while (bytes > 0) {
+        ssize_t written = write(fd, p, bytes);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        p += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+inline bool write_padding(int fd, unsigned long long &offset) {
+    static const char zeros[snapshot_alignment] = {};
+    const unsigned long long padding = (snapshot_alignment - offset % snapshot_alignment) % snapshot_alignment;
+    offset += padding;
+    return write_all(fd, zeros, padding);
+}
+
+/**
+ * Write `view` to `path` and fsync it, returns false on any I/O error.
+ */
+inline bool write_snapshot(const char *path, const SnapshotView &view) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    SnapshotHeader header = {};
+    std::copy(snapshot_magic, snapshot_magic + 8, header.magic);
+    header.version = snapshot_version;
+    header.num_arrays = view.num_arrays;
+    header.num_ranges = view.ranges.size();
+
+    SnapshotArray arrays[snapshot_max_arrays] = {};
+    const unsigned long long tables = sizeof(header) + view.num_arrays * sizeof(SnapshotArray)
+        + view.ranges.size() * sizeof(view.ranges[0]);
+    unsigned long long offset = tables;
+    for (unsigned i = 0; i != view.num_arrays; ++i) {
+        offset = (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+        arrays[i] = {view.arrays[i].count, view.arrays[i].node_size, offset};
+        offset += view.arrays[i].count * view.arrays[i].node_size;
+    }
+
+    bool ok = write_all(fd, &header, sizeof(header))
+        && write_all(fd, arrays, view.num_arrays * sizeof(SnapshotArray))
+        && write_all(fd, view.ranges.data(), view.ranges.size() * sizeof(view.ranges[0]));
+    offset = tables;
+    for (unsigned i = 0; ok && i != view.num_arrays; ++i) {
+        const size_t bytes = view.arrays[i].count * view.arrays[i].node_size;
+        ok = write_padding(fd, offset) && write_all(fd, view.arrays[i].data, bytes);
+        offset += bytes;
+    }
+    ok = fsync(fd) == 0 && ok;
+    return close(fd) == 0 && ok;
+}
+
+inline bool write_snapshot(const std::string &path, const SnapshotView &view) {
+    return write_snapshot(path.c_str(), view);
+}
+
+// A snapshot file mapped read-only; the arrays point into the mapping
+class MappedSnapshot {
+  private:
+    void *mapping = MAP_FAILED;
+    size_t length = 0;
+    const SnapshotHeader *header = nullptr;
+    const SnapshotArray *arrays = nullptr;
+    const std::pair<long long, long long> *range_data = nullptr;
+
+  public:
+    explicit MappedSnapshot(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapshotHeader)) {
+            length = st.st_size;
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            return;
+        }
+
+        const auto *candidate = static_cast<const SnapshotHeader *>(mapping);
+        if (!std::equal(candidate->magic, candidate->magic + 8, snapshot_magic)
+            || candidate->version != snapshot_version || candidate->num_arrays > snapshot_max_arrays) {
+            return;
+        }
+        const size_t tables = sizeof(SnapshotHeader) + candidate->num_arrays * sizeof(SnapshotArray);
+        if (tables > length || (length - tables) / sizeof(*range_data) < candidate->num_ranges) {
+            return;
+        }
+        arrays = reinterpret_cast<const SnapshotArray *>(candidate + 1);
+        for (unsigned i = 0; i != candidate->num_arrays; ++i) {
+            if (arrays[i].offset > length || arrays[i].node_size == 0
+                || (length - arrays[i].offset) / arrays[i].node_size < arrays[i].count) {
+                return;
+            }
+        }
+        range_data = reinterpret_cast<const std::pair<long long, long long> *>(arrays + candidate->num_arrays);
+        header = candidate;
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+
+    ~MappedSnapshot() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, length);
+        }
+    }
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    // False if the file could not be mapped, is truncated or of another format version
+    bool ok() const {
+        return header != nullptr;
+    }
+
+    unsigned numArrays() const {
+        return header->num_arrays;
+    }
+
+    size_t numRanges() const {
+        return header->num_ranges;
+    }
+
+    std::pair<long long, long long> range(size_t i) const {
+        return range_data[i];
+    }
+
+    // Array i if it holds exactly `count` nodes of type T, nullptr otherwise
+    template <typename T>
+    const T *array(unsigned i, size_t count) const {
+        if (i >= header->num_arrays || arrays[i].count != count || arrays[i].node_size != sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T *>(static_cast<const char *>(mapping) + arrays[i].offset);
+    }
+};
+
+/**
+ * Write a snapshot in the background. start() copies the arrays into a
+ * staging buffer with the OpenMP team, one pass at memory bandwidth, and a
+ * writer thread stores the copy to `path`.tmp, fsyncs it and renames it
+ * over `path`, so a crash never leaves a torn file behind. The buffer is
+ * reused by the next checkpoint. One checkpoint runs at a time.
+ */
+class BackgroundCheckpoint {
+  private:
+    std::vector<char, TreeAllocator<char>> staging;
+    SnapshotView staged;
+    std::thread writer;
+    std::atomic<bool> done{true};
+    bool last_ok = false;
+
+  public:
+    BackgroundCheckpoint() = default;
+
+    ~BackgroundCheckpoint() {
+        wait();
+    }
+
+    BackgroundCheckpoint(const BackgroundCheckpoint &) = delete;
+    BackgroundCheckpoint &operator=(const BackgroundCheckpoint &) = delete;
+
+    // The view's arrays must not change until start() returns; false if a checkpoint is still running
+    bool start(const SnapshotView &view, const std::string &path) {
+        if (running()) {
+            return false;
+        }
+        wait();
+
+        size_t offsets[snapshot_max_arrays];
+        size_t total = 0;
+        for (unsigned i = 0; i != view.num_arrays; ++i) {
+            offsets[i] = total;
+            total += round_up(view.arrays[i].count * view.arrays[i].node_size, snapshot_alignment);
+        }
+        staging.resize(total);
+
+        staged = {};
+        staged.ranges = view.ranges;
+        for (unsigned i = 0; i != view.num_arrays; ++i) {
+            const auto &array = view.arrays[i];
+            const char *source = static_cast<const char *>(array.data);
+            char *target = staging.data() + offsets[i];
+            const long long bytes = array.count * array.node_size;
+            const long long chunk = 1 << 20;
+
+            #pragma omp parallel for schedule(static)
+            for (long long begin = 0; begin < bytes; begin += chunk) {
+                std::copy(source + begin, source + std::min(begin + chunk, bytes), target + begin);
+            }
+            staged.arrays[staged.num_arrays++] = {target, array.count, array.node_size};
+        }
+
+        done.store(false, std::memory_order_relaxed);
+        writer = std::thread([this, path] {
+            const std::string temp = path + ".tmp";
+            last_ok = write_snapshot(temp, staged) && std::rename(temp.c_str(), path.c_str()) == 0;
+            done.store(true, std::memory_order_release);
+        });
+        return true;
+    }
+
+    // True while the writer thread is still storing the last checkpoint
+    bool running() const {
+        return !done.load(std::memory_order_acquire);
+    }
+
+    // Block until the last checkpoint is written, returns whether it succeeded
+    bool wait() {
+        if (writer.joinable()) {
+            writer.join();
+        }
+        return last_ok;
+    }
+};
+
+#endif
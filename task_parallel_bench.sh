@@ -1,7 +1,8 @@
 #!/usr/bin/env bash
 
-# Set script to stop if any command fails
+# Set script to stop if any command fails, also within the pipes
 set -e
+set -o pipefail
 
 # Display each command line
 set -x
@@ -10,63 +11,52 @@ set -x
 make clean
 make
 
-echo "Running Fenwick Tree benchmark with centralized scheduler..."
-
-# Add 1 since central scheduler only distributes task
-./fenwick -t central_scheduler -p 2 -s 4095 -b 262144 -n 100
-./fenwick -t central_scheduler -p 3 -s 4095 -b 262144 -n 100
-./fenwick -t central_scheduler -p 5 -s 4095 -b 262144 -n 100
-./fenwick -t central_scheduler -p 8 -s 4095 -b 262144 -n 100
-
-./fenwick -t central_scheduler -p 2 -s 2097151 -b 262144 -n 100
-./fenwick -t central_scheduler -p 3 -s 2097151 -b 262144 -n 100
-./fenwick -t central_scheduler -p 5 -s 2097151 -b 262144 -n 100
-./fenwick -t central_scheduler -p 8 -s 2097151 -b 262144 -n 100
-
-./fenwick -t central_scheduler -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t central_scheduler -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t central_scheduler -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t central_scheduler -p 8 -s 16777215 -b 262144 -n 100
-
-echo "Running Fenwick Tree benchmark with lockfree_scheduler scheduler..."
-
-# Add 1 since lockfree scheduler only distributes task
-./fenwick -t lockfree_scheduler -p 2 -s 4095 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 3 -s 4095 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 5 -s 4095 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 8 -s 4095 -b 262144 -n 100
-
-./fenwick -t lockfree_scheduler -p 2 -s 2097151 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 3 -s 2097151 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 5 -s 2097151 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 8 -s 2097151 -b 262144 -n 100
-
-./fenwick -t lockfree_scheduler -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t lockfree_scheduler -p 8 -s 16777215 -b 262144 -n 100
-
-echo "Running Fenwick Tree benchmark with lockfree_scheduler scheduler..."
-
-# Add 1 since lockfree scheduler only distributes task
-./fenwick -t pure_parallel -p 2 -s 4095 -b 262144 -n 100
-./fenwick -t pure_parallel -p 3 -s 4095 -b 262144 -n 100
-./fenwick -t pure_parallel -p 5 -s 4095 -b 262144 -n 100
-./fenwick -t pure_parallel -p 8 -s 4095 -b 262144 -n 100
-
-./fenwick -t pure_parallel -p 2 -s 2097151 -b 262144 -n 100
-./fenwick -t pure_parallel -p 3 -s 2097151 -b 262144 -n 100
-./fenwick -t pure_parallel -p 5 -s 2097151 -b 262144 -n 100
-./fenwick -t pure_parallel -p 8 -s 2097151 -b 262144 -n 100
-
-./fenwick -t pure_parallel -p 2 -s 16777215 -b 262144 -n 100
-./fenwick -t pure_parallel -p 3 -s 16777215 -b 262144 -n 100
-./fenwick -t pure_parallel -p 5 -s 16777215 -b 262144 -n 100
-./fenwick -t pure_parallel -p 8 -s 16777215 -b 262144 -n 100
+# One CSV row per run, for regression tracking
+OUT=${OUT:-task_parallel_bench.csv}
+: > "$OUT"
+
+# COUNTERS=default, or the raw event code of cache-line transfers, fills the hardware event columns (-i)
+COUNTERS=${COUNTERS:-}
+
+run() {
+    ./fenwick -o csv ${COUNTERS:+-i "$COUNTERS"} "$@" | { read -r header; [ -s "$OUT" ] || echo "$header" >> "$OUT"; cat >> "$OUT"; }
+}
+
+# -p counts the scheduling thread, which only distributes tasks
+for strategy in central_scheduler lockfree_scheduler snapshot_scheduler pure_parallel pure_parallel_pool; do
+    echo "Running Fenwick Tree benchmark with $strategy..."
+    for s in 4095 2097151 16777215; do
+        for p in 2 3 5 8; do
+            run -t $strategy -p $p -s $s -b 262144 -n 100
+        done
+    done
+done
+
+# Tasks per queue operation of the centralized schedulers, 1 hands over every task
+echo "Running Fenwick Tree benchmark with the scheduler chunk sizes..."
+for c in 1 16 256; do
+    for strategy in central_scheduler lockfree_scheduler; do
+        run -t $strategy -p 8 -c $c -s 2097151 -b 262144 -n 100
+    done
+done
+
+# Small batches, where spawning the pure_parallel workers per batch dominates
+echo "Running Fenwick Tree benchmark with per-batch threads and the persistent pool..."
+for b in 1024 16384; do
+    for strategy in pure_parallel pure_parallel_pool; do
+        run -t $strategy -p 8 -s 2097151 -b $b -n $((26214400 / b))
+    done
+done
 
 ## Test Query Percentage
 echo "Testing query percentage"
-
-./fenwick -t query_percentage_lazy -p 8 -s 16777215 -b 262144 -n 100
-./fenwick -t query_percentage_pure -p 8 -s 16777215 -b 262144 -n 100
-echo "Run complete."
\ No newline at end of file
+for q in 0 1 5 10 50 100 500 1000; do
+    run -t lazy -p 8 -q $q -s 16777215 -b 262144 -n 100
+    run -t pure_parallel -p 8 -q $q -s 16777215 -b 262144 -n 100
+    run -t pure_parallel_pool -p 8 -q $q -s 16777215 -b 262144 -n 100
+    run -t central_scheduler -p 8 -q $q -s 16777215 -b 262144 -n 100
+    run -t snapshot_scheduler -p 8 -q $q -s 16777215 -b 262144 -n 100
+    run -t async_scheduler -p 8 -q $q -s 16777215 -b 262144 -n 100
+done
+
+echo "Run complete, results in $OUT."
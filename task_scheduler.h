@@ -7,14 +7,17 @@
 #ifndef TASK_SCHEDULER_H
 #define TASK_SCHEDULER_H
 
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <queue>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <functional>
+#include <future>
 #include <pthread.h>
 #include <sched.h>
 
@@ -38,28 +41,49 @@ struct TaskQueue {
     std::condition_variable cv;
 };
 
-void pin_thread_to_core(int core_id) {
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(core_id, &cpuset);
-    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-    if (rc != 0) {
-        std::cerr << "Error calling pthread_setaffinity_np: " << rc << std::endl;
+// CPU of worker i; the submitting thread keeps the first CPU of the topology order
+inline int worker_cpu(int worker_id) {
+    return Topology::get().cpu(worker_id + 1);
+}
+
+// Block until `ready` counts every worker, which allocate and first-touch their state after pinning
+inline void wait_ready(const std::atomic<int>& ready, int num_workers) {
+    while (ready.load(std::memory_order_acquire) != num_workers) {
+        std::this_thread::yield();
     }
 }
 
+// Fixed-size slab of tasks, handed to a worker with a single queue operation
+struct TaskChunk {
+    static constexpr int capacity = 256;
+    int count = 0;
+    Task tasks[capacity];
+};
+
+/**
+ * The submitted tasks are buffered per worker and handed over `chunk_size`
+ * at a time with one lock and one notify; a worker drains its whole queue
+ * per wake-up. sync() flushes the partial chunks. Queries are appended to
+ * every worker's buffer after its earlier updates, so each worker still
+ * sees its tasks in submission order. chunk_size = 1 hands over every task.
+ */
 class Scheduler {
     public:
-    Scheduler(int num_workers, int tree_size, int batch_size)
-        : num_workers_(num_workers), tree_size_(tree_size), batch_size_(batch_size), results_(batch_size) {
+    Scheduler(int num_workers, int tree_size, int batch_size, int chunk_size = TaskChunk::capacity)
+        : num_workers_(num_workers), tree_size_(tree_size), batch_size_(batch_size),
+          chunk_size_(std::max(chunk_size, 1)), results_(batch_size), pending_(num_workers) {
         local_trees_.reserve(num_workers);
         task_queues_.reserve(num_workers);
 
         for (int i = 0; i < num_workers_; ++i) {
-            local_trees_.emplace_back(FenwickTreeSequential(tree_size_));
-            workers_.emplace_back(&Scheduler::worker_loop, this, i, i+1);
+            pending_[i].reserve(chunk_size_);
+            local_trees_.emplace_back(0);
             task_queues_.emplace_back(std::make_unique<TaskQueue>());
         }
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_.emplace_back(&Scheduler::worker_loop, this, i, worker_cpu(i));
+        }
+        wait_ready(ready_, num_workers_);
     }
 
     void init() {
@@ -79,12 +103,14 @@ class Scheduler {
 
     void sync() {
         broadcast_task({TaskType::Sync, 0, 0});
+        flush_all();
         while (sync_.load() != num_workers_);
         return;
     }
 
     void shutdown() {
         broadcast_task({TaskType::Finish, 0, 0});
+        flush_all();
         for (auto& t : workers_) {
             t.join();
         }
@@ -102,73 +128,111 @@ private:
     int num_workers_;
     int tree_size_;
     int batch_size_;
+    int chunk_size_;
     int counter_ = 0;
     std::vector<std::thread> workers_;
     std::vector<std::unique_ptr<TaskQueue>> task_queues_;
     std::vector<std::atomic<int>> results_;
-    std::vector<FenwickTreeSequential> local_trees_;
+    std::vector<FenwickTreeSequential<>> local_trees_; // allocated by their workers
+    std::vector<std::vector<Task>> pending_;
     std::atomic<int> sync_ = 0;
+    std::atomic<int> ready_ = 0;
 
-    void enqueue_task(Task task) {
-        int worker_id = counter_++ % num_workers_;
+    void push_task(int worker_id, Task task) {
+        auto& pending = pending_[worker_id];
+        pending.push_back(task);
+        if ((int)pending.size() >= chunk_size_) {
+            flush(worker_id);
+        }
+    }
+
+    void flush(int worker_id) {
+        auto& pending = pending_[worker_id];
+        if (pending.empty()) {
+            return;
+        }
         auto& q = *task_queues_[worker_id];
         {
             std::lock_guard<std::mutex> lock(q.mutex);
-            q.queue.push(task);
+            for (const auto& task : pending) {
+                q.queue.push(task);
+            }
         }
         q.cv.notify_one();
+        pending.clear();
+    }
+
+    void flush_all() {
+        for (int i = 0; i < num_workers_; ++i) {
+            flush(i);
+        }
+    }
+
+    void enqueue_task(Task task) {
+        push_task(counter_++ % num_workers_, task);
     }
 
     void broadcast_task(Task task) {
         for (int i = 0; i < num_workers_; ++i) {
-            auto& q = *task_queues_[i];
-            {
-                std::lock_guard<std::mutex> lock(q.mutex);
-                q.queue.push(task);
-            }
-            q.cv.notify_one();
+            push_task(i, task);
         }
     }
 
     void worker_loop(int worker_id, int core_id) {
         pin_thread_to_core(core_id);
+        local_trees_[worker_id] = FenwickTreeSequential<>(tree_size_);
+        ready_.fetch_add(1, std::memory_order_release);
 
         TaskQueue& q = *task_queues_[worker_id];
+        std::queue<Task> tasks;
         while (true) {
-            Task task;
             {
                 std::unique_lock<std::mutex> lock(q.mutex);
                 q.cv.wait(lock, [&]() { return !q.queue.empty(); });
-                task = q.queue.front();
-                q.queue.pop();
+                std::swap(tasks, q.queue);
             }
 
-            if (task.type == TaskType::Update) {
-                local_trees_[worker_id].add(task.index, task.value);
-            } else if (task.type == TaskType::Query) {
-                int result = local_trees_[worker_id].sum(task.index);
-                results_[task.value].fetch_add(result, std::memory_order_relaxed);
-            } else if (task.type == TaskType::Sync) {
-                sync_++;
-            } else if (task.type == TaskType::Finish) {
-                return;
+            for (; !tasks.empty(); tasks.pop()) {
+                const Task& task = tasks.front();
+                if (task.type == TaskType::Update) {
+                    local_trees_[worker_id].add(task.index, task.value);
+                } else if (task.type == TaskType::Query) {
+                    int result = local_trees_[worker_id].sum(task.index);
+                    results_[task.value].fetch_add(result, std::memory_order_relaxed);
+                } else if (task.type == TaskType::Sync) {
+                    sync_++;
+                } else if (task.type == TaskType::Finish) {
+                    return;
+                }
             }
         }
     }
 };
 
+/**
+ * Same buffering as Scheduler over lock-free SPSC queues of TaskChunk
+ * pointers. Each worker hands its drained slabs back through a second SPSC
+ * queue, so the producer reuses them instead of allocating.
+ */
 class LockFreeScheduler {
     public:
-    LockFreeScheduler(int num_workers, int tree_size, int batch_size)
-        : num_workers_(num_workers), tree_size_(tree_size), batch_size_(batch_size), results_(batch_size) {
+    LockFreeScheduler(int num_workers, int tree_size, int batch_size, int chunk_size = TaskChunk::capacity)
+        : num_workers_(num_workers), tree_size_(tree_size), batch_size_(batch_size),
+          chunk_size_(std::clamp(chunk_size, 1, TaskChunk::capacity)), results_(batch_size),
+          pending_(num_workers, nullptr), slabs_(num_workers) {
         local_trees_.reserve(num_workers);
         task_queues_.reserve(num_workers);
+        free_queues_.reserve(num_workers);
 
         for (int i = 0; i < num_workers_; ++i) {
-            local_trees_.emplace_back(FenwickTreeSequential(tree_size_));
-            workers_.emplace_back(&LockFreeScheduler::worker_loop, this, i, i+1);
-            task_queues_.emplace_back(BlockingReaderWriterQueue<Task>(100));
+            local_trees_.emplace_back(0);
+            task_queues_.emplace_back(BlockingReaderWriterQueue<TaskChunk*>(100));
+            free_queues_.emplace_back(ReaderWriterQueue<TaskChunk*>(100));
+        }
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_.emplace_back(&LockFreeScheduler::worker_loop, this, i, worker_cpu(i));
         }
+        wait_ready(ready_, num_workers_);
     }
 
     void init() {
@@ -188,12 +252,14 @@ class LockFreeScheduler {
 
     void sync() {
         broadcast_task({TaskType::Sync, 0, 0});
+        flush_all();
         while (sync_.load() != num_workers_);
         return;
     }
 
     void shutdown() {
         broadcast_task({TaskType::Finish, 0, 0});
+        flush_all();
         for (auto& t : workers_) {
             t.join();
         }
@@ -211,42 +277,82 @@ private:
     int num_workers_;
     int tree_size_;
     int batch_size_;
+    int chunk_size_;
     int counter_ = 0;
     std::vector<std::thread> workers_;
-    std::vector<BlockingReaderWriterQueue<Task>> task_queues_;
+    std::vector<BlockingReaderWriterQueue<TaskChunk*>> task_queues_;
+    std::vector<ReaderWriterQueue<TaskChunk*>> free_queues_;
     std::vector<std::atomic<int>> results_;
-    std::vector<FenwickTreeSequential> local_trees_;
+    std::vector<FenwickTreeSequential<>> local_trees_; // allocated by their workers
+    std::vector<TaskChunk*> pending_;
+    std::vector<std::vector<std::unique_ptr<TaskChunk>>> slabs_; // every slab of a worker, owned here
     std::atomic<int> sync_ = 0;
+    std::atomic<int> ready_ = 0;
+
+    void push_task(int worker_id, Task task) {
+        auto& chunk = pending_[worker_id];
+        if (!chunk) {
+            if (!free_queues_[worker_id].try_dequeue(chunk)) {
+                slabs_[worker_id].push_back(std::make_unique<TaskChunk>());
+                chunk = slabs_[worker_id].back().get();
+            }
+            chunk->count = 0;
+        }
+        chunk->tasks[chunk->count++] = task;
+        if (chunk->count >= chunk_size_) {
+            flush(worker_id);
+        }
+    }
+
+    void flush(int worker_id) {
+        if (pending_[worker_id]) {
+            task_queues_[worker_id].enqueue(pending_[worker_id]);
+            pending_[worker_id] = nullptr;
+        }
+    }
+
+    void flush_all() {
+        for (int i = 0; i < num_workers_; ++i) {
+            flush(i);
+        }
+    }
 
     void enqueue_task(Task task) {
-        int worker_id = counter_++ % num_workers_;
-        auto& q = task_queues_[worker_id];
-        q.enqueue(task);
+        push_task(counter_++ % num_workers_, task);
     }
 
     void broadcast_task(Task task) {
         for (int i = 0; i < num_workers_; ++i) {
-            auto& q = task_queues_[i];
-            q.enqueue(task);
+            push_task(i, task);
         }
     }
 
     void worker_loop(int worker_id, int core_id) {
         pin_thread_to_core(core_id);
+        local_trees_[worker_id] = FenwickTreeSequential<>(tree_size_);
+        ready_.fetch_add(1, std::memory_order_release);
 
         auto& q = task_queues_[worker_id];
         while (true) {
-            Task task;
-            q.wait_dequeue(task);
-
-            if (task.type == TaskType::Update) {
-                local_trees_[worker_id].add(task.index, task.value);
-            } else if (task.type == TaskType::Query) {
-                int result = local_trees_[worker_id].sum(task.index);
-                results_[task.value].fetch_add(result, std::memory_order_relaxed);
-            } else if (task.type == TaskType::Sync) {
-                sync_++;
-            } else if (task.type == TaskType::Finish) {
+            TaskChunk* chunk;
+            q.wait_dequeue(chunk);
+
+            bool finish = false;
+            for (int i = 0; i < chunk->count; ++i) {
+                const Task& task = chunk->tasks[i];
+                if (task.type == TaskType::Update) {
+                    local_trees_[worker_id].add(task.index, task.value);
+                } else if (task.type == TaskType::Query) {
+                    int result = local_trees_[worker_id].sum(task.index);
+                    results_[task.value].fetch_add(result, std::memory_order_relaxed);
+                } else if (task.type == TaskType::Sync) {
+                    sync_++;
+                } else if (task.type == TaskType::Finish) {
+                    finish = true;
+                }
+            }
+            free_queues_[worker_id].enqueue(chunk);
+            if (finish) {
                 return;
             }
         }
@@ -256,13 +362,13 @@ private:
 class DecentralizedScheduler {
     public:
     DecentralizedScheduler(int num_workers, int batch_size, 
-        std::vector<Operation>& operations, std::vector<FenwickTreeSequential>& local_trees)
+        Span<const Operation> operations, std::vector<FenwickTreeSequential<>>& local_trees)
         : num_workers_(num_workers), batch_size_(batch_size), results_(batch_size) {
         for (int i = 0; i < num_workers_; ++i) {
             results_[i] = std::vector<int>(batch_size_);
         }
         for (int i = 0; i < num_workers_; ++i) {
-            workers_.emplace_back(&DecentralizedScheduler::worker_loop, this, i, i+1, std::ref(operations), std::ref(local_trees[i]));
+            workers_.emplace_back(&DecentralizedScheduler::worker_loop, this, i, worker_cpu(i), operations, std::ref(local_trees[i]));
         }
     }
 
@@ -288,7 +394,7 @@ private:
     std::vector<std::thread> workers_;
     std::vector<std::vector<int>> results_;
 
-    void worker_loop(int worker_id, int core_id, std::vector<Operation>& operations, FenwickTreeSequential& local_tree) {
+    void worker_loop(int worker_id, int core_id, Span<const Operation> operations, FenwickTreeSequential<>& local_tree) {
         pin_thread_to_core(core_id);
 
         int counter = 0;
@@ -304,4 +410,746 @@ private:
         }
     }
 };
+/**
+ * Epoch handoff from one producer to a pool of workers: publish() starts an
+ * epoch, every worker picks it up in wait() and reports back with arrive(),
+ * and the producer blocks in wait_all() until all of them did. Waiters spin
+ * for a while and then sleep, straight away when the threads outnumber the
+ * cores, since a spinning thread then only delays the one it waits for.
+ * The workers may also arrive() once before the first epoch, to report
+ * their start-up to a wait_all().
+ */
+class EpochGate {
+    public:
+    explicit EpochGate(int num_workers)
+        : num_workers_(num_workers),
+          spin_limit_(num_workers + 1 > (int)std::thread::hardware_concurrency() ? 0 : 4096) {}
+
+    void publish() {
+        done_.store(0, std::memory_order_relaxed);
+        epoch_.fetch_add(1, std::memory_order_release);
+        // A worker checks the epoch under the mutex before it sleeps, so it cannot miss this wake-up
+        { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+        wake_.notify_all();
+    }
+
+    // Block until the epoch differs from `seen`, returns the new epoch
+    unsigned wait(unsigned seen) {
+        unsigned spins = 0;
+        unsigned epoch;
+        while ((epoch = epoch_.load(std::memory_order_acquire)) == seen) {
+            if (spins == spin_limit_) {
+                std::unique_lock<std::mutex> lock(sleep_mutex_);
+                wake_.wait(lock, [&]() { return epoch_.load(std::memory_order_acquire) != seen; });
+                continue;
+            }
+            cpu_relax(spins);
+        }
+        return epoch;
+    }
+
+    void arrive() {
+        done_.fetch_add(1, std::memory_order_release);
+    }
+
+    void wait_all() {
+        unsigned spins = 0;
+        while (done_.load(std::memory_order_acquire) != num_workers_) {
+            if (spin_limit_ == 0) {
+                std::this_thread::yield();
+            } else {
+                cpu_relax(spins);
+            }
+        }
+    }
+
+private:
+    int num_workers_;
+    unsigned spin_limit_;
+    alignas(64) std::atomic<unsigned> epoch_ = 0;
+    alignas(64) std::atomic<int> done_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+};
+
+/**
+ * Persistent variant of DecentralizedScheduler: the workers are spawned and
+ * pinned once and each batch is handed out through an EpochGate, instead
+ * of a thread spawn and join per worker. The result buffers are reused
+ * across batches and only grow.
+ */
+class DecentralizedPool {
+    public:
+    DecentralizedPool(int num_workers, int tree_size, int batch_size)
+        : num_workers_(num_workers), tree_size_(tree_size), gate_(num_workers) {
+        workers_.reserve(num_workers);
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_.push_back({FenwickTreeSequential<>(0), std::vector<int>(batch_size)});
+        }
+        for (int i = 0; i < num_workers_; ++i) {
+            threads_.emplace_back(&DecentralizedPool::worker_loop, this, i, worker_cpu(i));
+        }
+        // The workers report their allocation like the end of an epoch
+        gate_.wait_all();
+    }
+
+    // Hand the batch to every worker, `operations` must stay valid until sync() returns
+    void submit_batch(Span<const Operation> operations) {
+        // The workers are idle between sync() and the next epoch
+        for (auto& worker : workers_) {
+            if (worker.results.size() < operations.size()) {
+                worker.results.resize(operations.size());
+            }
+        }
+        operations_ = operations;
+        gate_.publish();
+    }
+
+    void sync() {
+        gate_.wait_all();
+    }
+
+    void shutdown() {
+        stop_.store(true, std::memory_order_relaxed);
+        gate_.publish();
+        for (auto& t : threads_) {
+            t.join();
+        }
+        threads_.clear();
+    }
+
+    // Sum of the answers to the queries of the last batch; the slots of the updates are stale
+    int validate_sum() {
+        int res = 0;
+        for (size_t j = 0; j < operations_.size(); j++) {
+            if (operations_[j].command != 'a') {
+                for (const auto& worker : workers_) {
+                    res += worker.results[j];
+                }
+            }
+        }
+        return res;
+    }
+
+private:
+    // One cache line apart so the workers do not false-share their headers
+    struct alignas(64) Worker {
+        FenwickTreeSequential<> tree;
+        std::vector<int> results;
+    };
+
+    int num_workers_;
+    int tree_size_;
+    std::vector<Worker> workers_; // trees allocated by their workers
+    std::vector<std::thread> threads_;
+    Span<const Operation> operations_;
+    EpochGate gate_;
+    std::atomic<bool> stop_ = false;
+
+    void worker_loop(int worker_id, int core_id) {
+        pin_thread_to_core(core_id);
+
+        auto& worker = workers_[worker_id];
+        worker.tree = FenwickTreeSequential<>(tree_size_);
+        gate_.arrive();
+
+        unsigned seen = 0;
+        while (true) {
+            seen = gate_.wait(seen);
+            if (stop_.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            int counter = 0;
+            for (size_t i = 0; i < operations_.size(); ++i) {
+                const auto& op = operations_[i];
+                if (op.command == 'a') {
+                    if (counter++ % num_workers_ == worker_id) {
+                        worker.tree.add(op.index, op.value);
+                    }
+                } else {
+                    worker.results[i] = worker.tree.sum(op.index);
+                }
+            }
+            gate_.arrive();
+        }
+    }
+};
+
+/**
+ * Scheduler that answers every query in the submitting thread, with no
+ * broadcast. The updates are buffered and, every `merge_size` of them,
+ * merged into one shared tree by all workers in parallel. Each worker
+ * walks the whole chunk within its own node range, as the model-parallel
+ * trees do. Each merge publishes the next version of the shared snapshot.
+ * A query reads the snapshot plus a scan of the updates not merged yet,
+ * which together are exactly the updates submitted before it. It only
+ * waits for a merge that is still in flight. Submission overlaps the merge
+ * of the previous chunk. `merge_size` trades one barrier per merge against
+ * the length of that scan.
+ */
+class SnapshotScheduler {
+    public:
+    SnapshotScheduler(int num_workers, int tree_size, int batch_size, int merge_size = TaskChunk::capacity)
+        : num_workers_(num_workers), merge_size_(std::max(merge_size, 1)), tree_(tree_size, Uninitialized()),
+          ranges_(partition_ranges<int>(access_cost<int>(tree_size), num_workers)),
+          results_(batch_size), gate_(num_workers) {
+        pending_.reserve(merge_size_);
+        merging_.reserve(merge_size_);
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_.emplace_back(&SnapshotScheduler::worker_loop, this, i, worker_cpu(i));
+        }
+        gate_.wait_all();
+    }
+
+    void init() {
+        std::fill(results_.begin(), results_.end(), 0);
+    }
+
+    void submit_update(int index, int value) {
+        pending_.push_back({TaskType::Update, index, value});
+        if ((int)pending_.size() >= merge_size_) {
+            start_merge();
+        }
+    }
+
+    void submit_query(int index, int batch_id) {
+        finish_merge();
+        int res = tree_.sum(index);
+        for (const auto& task : pending_) {
+            if (task.index <= index) {
+                res += task.value;
+            }
+        }
+        results_[batch_id] = res;
+    }
+
+    // Merge the remaining updates, the snapshot then holds every submitted update
+    void sync() {
+        start_merge();
+        finish_merge();
+    }
+
+    void shutdown() {
+        finish_merge();
+        stop_.store(true, std::memory_order_relaxed);
+        gate_.publish();
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+
+    int validate_sum() {
+        int res = 0;
+        for (int result : results_) {
+            res += result;
+        }
+        return res;
+    }
+
+    // Number of snapshots merged so far
+    unsigned version() const {
+        return version_;
+    }
+
+private:
+    int num_workers_;
+    int merge_size_;
+    FenwickTree<> tree_; // each range first-touched by its worker
+    std::vector<std::pair<int, int>> ranges_;
+    std::vector<int> results_;
+    std::vector<Task> pending_; // submitted after the last merge started
+    std::vector<Task> merging_; // the chunk of the merge in flight
+    bool in_flight_ = false;
+    unsigned version_ = 0;
+    std::vector<std::thread> workers_;
+    EpochGate gate_;
+    std::atomic<bool> stop_ = false;
+
+    void start_merge() {
+        finish_merge();
+        if (pending_.empty()) {
+            return;
+        }
+        std::swap(pending_, merging_);
+        pending_.clear();
+        in_flight_ = true;
+        gate_.publish();
+    }
+
+    void finish_merge() {
+        if (in_flight_) {
+            gate_.wait_all();
+            in_flight_ = false;
+            ++version_;
+        }
+    }
+
+    void worker_loop(int worker_id, int core_id) {
+        pin_thread_to_core(core_id);
+
+        const auto [lower, upper] = ranges_[worker_id];
+        tree_.clearWithin(worker_id == 0 ? 0 : lower, upper);
+        gate_.arrive();
+
+        unsigned seen = 0;
+        while (true) {
+            seen = gate_.wait(seen);
+            if (stop_.load(std::memory_order_relaxed)) {
+                return;
+            }
+            for (const auto& task : merging_) {
+                tree_.addWithin(task.index + 1, task.value, lower, upper);
+            }
+            gate_.arrive();
+        }
+    }
+};
+
+/**
+ * Asynchronous front end: submit_add() and submit_query() return at once
+ * and a query resolves through a callback or a future. The tasks are cut
+ * into chunks of `chunk_size` and passed to a coordinator thread, which
+ * runs every chunk in two phases over the worker pool. First the workers
+ * answer the chunk's queries round-robin, each from the shared tree, which
+ * then holds every earlier chunk, plus the updates before it in the chunk.
+ * Then every worker applies the chunk's updates within its own node range.
+ * So each query sees exactly the updates submitted before it, at the cost
+ * of two handoffs per chunk and no barrier per query. The submitting
+ * thread only blocks in drain().
+ */
+class AsyncScheduler {
+    public:
+    AsyncScheduler(int num_workers, int tree_size, int chunk_size = TaskChunk::capacity)
+        : num_workers_(num_workers), chunk_size_(std::max(chunk_size, 1)), tree_(tree_size, Uninitialized()),
+          ranges_(partition_ranges<int>(access_cost<int>(tree_size), num_workers)),
+          chunks_(16), free_chunks_(16), gate_(num_workers) {
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_.emplace_back(&AsyncScheduler::worker_loop, this, i, worker_cpu(i));
+        }
+        gate_.wait_all();
+        coordinator_ = std::thread(&AsyncScheduler::coordinator_loop, this);
+    }
+
+    void submit_add(int index, int value) {
+        push({TaskType::Update, index, value});
+    }
+
+    // `callback` receives the sum over [0, index] on a worker thread
+    void submit_query(int index, std::function<void(int)> callback) {
+        Chunk& chunk = pending();
+        chunk.callbacks.push_back(std::move(callback));
+        push({TaskType::Query, index, (int)chunk.callbacks.size() - 1});
+    }
+
+    std::future<int> submit_query(int index) {
+        auto promise = std::make_shared<std::promise<int>>();
+        std::future<int> result = promise->get_future();
+        submit_query(index, [promise](int sum) { promise->set_value(sum); });
+        return result;
+    }
+
+    // Hand over the partial chunk without waiting for it
+    void flush() {
+        if (pending_ && !pending_->tasks.empty()) {
+            chunks_.enqueue(pending_);
+            pending_ = nullptr;
+            ++submitted_;
+        }
+    }
+
+    // Flush and wait until every submitted task is applied and every query resolved
+    void drain() {
+        flush();
+        unsigned spins = 0;
+        while (completed_.load(std::memory_order_acquire) != submitted_) {
+            cpu_relax(spins);
+        }
+    }
+
+    void shutdown() {
+        drain();
+        chunks_.enqueue(nullptr);
+        coordinator_.join();
+    }
+
+    // Sum over [0, index], valid after drain()
+    int sum(int index) const {
+        return tree_.sum(index);
+    }
+
+private:
+    struct Chunk {
+        std::vector<Task> tasks; // a query's value is its slot in `callbacks`
+        std::vector<std::function<void(int)>> callbacks;
+        bool has_updates = false;
+    };
+
+    enum class Phase { Queries, Updates };
+
+    int num_workers_;
+    int chunk_size_;
+    FenwickTree<> tree_; // each range first-touched by its worker
+    std::vector<std::pair<int, int>> ranges_;
+    std::vector<std::unique_ptr<Chunk>> slabs_; // every chunk, owned here
+    Chunk* pending_ = nullptr;
+    size_t submitted_ = 0;
+    alignas(64) std::atomic<size_t> completed_ = 0;
+    BlockingReaderWriterQueue<Chunk*> chunks_;  // submitting thread -> coordinator, nullptr stops it
+    ReaderWriterQueue<Chunk*> free_chunks_;     // coordinator -> submitting thread
+    Chunk* current_ = nullptr;
+    Phase phase_ = Phase::Queries;
+    std::vector<std::thread> workers_;
+    std::thread coordinator_;
+    EpochGate gate_;
+    std::atomic<bool> stop_ = false;
+
+    Chunk& pending() {
+        if (!pending_) {
+            if (!free_chunks_.try_dequeue(pending_)) {
+                slabs_.push_back(std::make_unique<Chunk>());
+                pending_ = slabs_.back().get();
+                pending_->tasks.reserve(chunk_size_);
+            }
+            pending_->tasks.clear();
+            pending_->callbacks.clear();
+            pending_->has_updates = false;
+        }
+        return *pending_;
+    }
+
+    void push(Task task) {
+        Chunk& chunk = pending();
+        chunk.tasks.push_back(task);
+        chunk.has_updates |= task.type == TaskType::Update;
+        if ((int)chunk.tasks.size() >= chunk_size_) {
+            flush();
+        }
+    }
+
+    void run_phase(Phase phase) {
+        phase_ = phase;
+        gate_.publish();
+        gate_.wait_all();
+    }
+
+    void coordinator_loop() {
+        while (true) {
+            Chunk* chunk;
+            chunks_.wait_dequeue(chunk);
+            if (!chunk) {
+                break;
+            }
+            current_ = chunk;
+            if (!chunk->callbacks.empty()) {
+                run_phase(Phase::Queries);
+            }
+            if (chunk->has_updates) {
+                run_phase(Phase::Updates);
+            }
+            free_chunks_.enqueue(chunk);
+            completed_.fetch_add(1, std::memory_order_release);
+        }
+
+        stop_.store(true, std::memory_order_relaxed);
+        gate_.publish();
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+
+    void answer_queries(int worker_id) {
+        const auto& tasks = current_->tasks;
+        int query = 0;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            if (tasks[i].type != TaskType::Query || query++ % num_workers_ != worker_id) {
+                continue;
+            }
+            int index = tasks[i].index;
+            int res = tree_.sum(index);
+            for (size_t j = 0; j < i; ++j) {
+                if (tasks[j].type == TaskType::Update && tasks[j].index <= index) {
+                    res += tasks[j].value;
+                }
+            }
+            current_->callbacks[tasks[i].value](res);
+        }
+    }
+
+    void worker_loop(int worker_id, int core_id) {
+        pin_thread_to_core(core_id);
+
+        const auto [lower, upper] = ranges_[worker_id];
+        tree_.clearWithin(worker_id == 0 ? 0 : lower, upper);
+        gate_.arrive();
+
+        unsigned seen = 0;
+        while (true) {
+            seen = gate_.wait(seen);
+            if (stop_.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (phase_ == Phase::Queries) {
+                answer_queries(worker_id);
+            } else {
+                for (const auto& task : current_->tasks) {
+                    if (task.type == TaskType::Update) {
+                        tree_.addWithin(task.index + 1, task.value, lower, upper);
+                    }
+                }
+            }
+            gate_.arrive();
+        }
+    }
+};
+
+/**
+ * Chase-Lev work-stealing deque (the C11 formulation of Le et al.): the
+ * owner pushes and pops at the bottom, any other thread steals from the
+ * top, and only the race for the last element goes through a CAS. The
+ * capacity is fixed by reserve(), which like reset() may only be called
+ * while no thread uses the deque.
+ */
+template <typename T>
+class ChaseLevDeque {
+    public:
+    void reserve(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        if (size > capacity_) {
+            buffer_ = std::make_unique<std::atomic<T>[]>(size);
+            capacity_ = size;
+        }
+        reset();
+    }
+
+    void reset() {
+        top_.store(0, std::memory_order_relaxed);
+        bottom_.store(0, std::memory_order_relaxed);
+    }
+
+    // Owner only, the deque must have room
+    void push(T value) {
+        long b = bottom_.load(std::memory_order_relaxed);
+        buffer_[b & (capacity_ - 1)].store(value, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only
+    bool pop(T& value) {
+        long b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top_.load(std::memory_order_relaxed);
+
+        bool found = t <= b;
+        if (found) {
+            value = buffer_[b & (capacity_ - 1)].load(std::memory_order_relaxed);
+            if (t == b) {
+                // Last element, race the thieves for it
+                found = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return found;
+    }
+
+    bool steal(T& value) {
+        long t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        value = buffer_[t & (capacity_ - 1)].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    private:
+    std::unique_ptr<std::atomic<T>[]> buffer_;
+    size_t capacity_ = 0;
+    alignas(64) std::atomic<long> top_ = 0;
+    alignas(64) std::atomic<long> bottom_ = 0;
+};
+
+/**
+ * Work-stealing scheduler: the submitted updates are handed out in
+ * segments, cut into chunks of `chunk_size` and dealt round-robin into
+ * per-worker Chase-Lev deques. A worker drains its own deque into its local
+ * tree and then steals chunks from the others, so a preempted or slow
+ * worker only holds up the chunk it is on. Any local tree may take any
+ * update, as the answer is the sum over all of them. A segment runs while
+ * the next one is submitted. A query waits for the segment in flight and
+ * is answered in the submitting thread from the local trees plus a scan of
+ * the updates not handed out yet.
+ */
+class WorkStealingScheduler {
+    public:
+    WorkStealingScheduler(int num_workers, int tree_size, int batch_size, int chunk_size = TaskChunk::capacity)
+        : num_workers_(num_workers), chunk_size_(std::max(chunk_size, 1)), results_(batch_size),
+          deques_(num_workers), steals_(num_workers), gate_(num_workers) {
+        local_trees_.reserve(num_workers);
+        for (int i = 0; i < num_workers_; ++i) {
+            local_trees_.emplace_back(0);
+        }
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_.emplace_back(&WorkStealingScheduler::worker_loop, this, i, worker_cpu(i), tree_size);
+        }
+        gate_.wait_all();
+    }
+
+    void init() {
+        std::fill(results_.begin(), results_.end(), 0);
+    }
+
+    void submit_update(int index, int value) {
+        pending_.push_back({TaskType::Update, index, value});
+        // Bound the segment so a query-free stream still overlaps submission and execution
+        if (pending_.size() >= (size_t)chunk_size_ * num_workers_ * 64) {
+            start_segment();
+        }
+    }
+
+    void submit_query(int index, int batch_id) {
+        finish_segment();
+        int res = 0;
+        for (const auto& tree : local_trees_) {
+            res += tree.sum(index);
+        }
+        for (const auto& task : pending_) {
+            if (task.index <= index) {
+                res += task.value;
+            }
+        }
+        results_[batch_id] = res;
+
+        // Hand out the scanned updates once they are worth a chunk per worker, which bounds the scan
+        if (pending_.size() >= (size_t)chunk_size_ * num_workers_) {
+            start_segment();
+        }
+    }
+
+    void sync() {
+        start_segment();
+        finish_segment();
+    }
+
+    void shutdown() {
+        finish_segment();
+        stop_.store(true, std::memory_order_relaxed);
+        gate_.publish();
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+
+    int validate_sum() {
+        int res = 0;
+        for (int result : results_) {
+            res += result;
+        }
+        return res;
+    }
+
+    // Chunks taken from another worker's deque, per worker
+    std::vector<unsigned long long> steals() const {
+        std::vector<unsigned long long> result;
+        for (const auto& count : steals_) {
+            result.push_back(count.value);
+        }
+        return result;
+    }
+
+private:
+    struct alignas(64) StealCount {
+        unsigned long long value = 0;
+    };
+
+    int num_workers_;
+    int chunk_size_;
+    std::vector<int> results_;
+    std::vector<FenwickTreeSequential<>> local_trees_; // allocated by their workers
+    std::vector<Task> pending_;  // submitted after the last segment started
+    std::vector<Task> running_;  // the segment in flight
+    bool in_flight_ = false;
+    std::vector<ChaseLevDeque<int>> deques_;
+    std::vector<StealCount> steals_;
+    std::vector<std::thread> workers_;
+    EpochGate gate_;
+    std::atomic<bool> stop_ = false;
+
+    void start_segment() {
+        finish_segment();
+        if (pending_.empty()) {
+            return;
+        }
+        std::swap(pending_, running_);
+        pending_.clear();
+
+        // The workers are parked, so the deques can be refilled from here
+        int chunks = (int)((running_.size() + chunk_size_ - 1) / chunk_size_);
+        for (int w = 0; w < num_workers_; ++w) {
+            deques_[w].reserve((chunks + num_workers_ - 1) / num_workers_);
+        }
+        for (int c = 0; c < chunks; ++c) {
+            deques_[c % num_workers_].push(c);
+        }
+        in_flight_ = true;
+        gate_.publish();
+    }
+
+    void finish_segment() {
+        if (in_flight_) {
+            gate_.wait_all();
+            in_flight_ = false;
+        }
+    }
+
+    void apply_chunk(int worker_id, int chunk) {
+        size_t begin = (size_t)chunk * chunk_size_;
+        size_t end = std::min(running_.size(), begin + chunk_size_);
+        auto& tree = local_trees_[worker_id];
+        for (size_t i = begin; i < end; ++i) {
+            tree.add(running_[i].index, running_[i].value);
+        }
+    }
+
+    void worker_loop(int worker_id, int core_id, int tree_size) {
+        pin_thread_to_core(core_id);
+        local_trees_[worker_id] = FenwickTreeSequential<>(tree_size);
+        gate_.arrive();
+
+        unsigned seen = 0;
+        while (true) {
+            seen = gate_.wait(seen);
+            if (stop_.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            int chunk;
+            while (deques_[worker_id].pop(chunk)) {
+                apply_chunk(worker_id, chunk);
+            }
+            // No chunk is added during a segment, so one empty sweep over the victims ends it
+            for (bool stolen = true; stolen;) {
+                stolen = false;
+                for (int k = 1; k < num_workers_; ++k) {
+                    int victim = (worker_id + k) % num_workers_;
+                    while (deques_[victim].steal(chunk)) {
+                        apply_chunk(worker_id, chunk);
+                        ++steals_[worker_id].value;
+                        stolen = true;
+                    }
+                }
+            }
+            gate_.arrive();
+        }
+    }
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+/**
+ * CPU and NUMA topology of the CPUs this process may run on, read from
+ * sysfs the way hwloc and libnuma discover it, so the build needs neither.
+ * Threads are placed in the order of Topology::cpu(): one thread per
+ * physical core, node by node, and only then the SMT siblings. Thread i and
+ * i + 1 share a node wherever they can, so the neighbouring node ranges of
+ * the model-parallel trees, which the threads first-touch, stay on the
+ * same node. Without sysfs every allowed CPU counts as its own core of a
+ * single node.
+ */
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+
+inline void pin_thread_to_core(int core_id) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core_id, &cpuset);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (rc != 0) {
+        std::cerr << "Error calling pthread_setaffinity_np: " << rc << std::endl;
+    }
+}
+
+// CPUs of a sysfs list such as "0-3,8-11"
+inline std::vector<int> parse_cpu_list(const std::string &list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        std::string item = list.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        size_t dash = item.find('-');
+        try {
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::logic_error &) {
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+class Topology {
+  public:
+    // Parsed once, from the affinity of the first caller
+    static const Topology &get() {
+        static const Topology topology;
+        return topology;
+    }
+
+    size_t cpus() const {
+        return order.size();
+    }
+
+    int nodes() const {
+        return num_nodes;
+    }
+
+    // CPU of the i-th thread, wrapping around when the threads outnumber the CPUs
+    int cpu(size_t i) const {
+        return order[i % order.size()].cpu;
+    }
+
+  private:
+    struct Cpu {
+        int cpu;
+        int node;
+        int package;
+        int core;
+        int sibling; // rank among the hardware threads of its core
+    };
+
+    std::vector<Cpu> order;
+    int num_nodes = 1;
+
+    static int read_int(const std::string &path, int fallback) {
+        std::ifstream in(path);
+        int value;
+        return in >> value ? value : fallback;
+    }
+
+    Topology() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            CPU_SET(0, &allowed);
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+                order.push_back({cpu, 0, read_int(dir + "physical_package_id", 0), read_int(dir + "core_id", cpu), 0});
+            }
+        }
+
+        std::vector<int> used_nodes;
+        for (int node = 0; node < CPU_SETSIZE; ++node) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            if (!std::getline(in, list)) {
+                continue;
+            }
+            for (int cpu : parse_cpu_list(list)) {
+                for (auto &entry : order) {
+                    if (entry.cpu == cpu) {
+                        entry.node = node;
+                        if (std::find(used_nodes.begin(), used_nodes.end(), node) == used_nodes.end()) {
+                            used_nodes.push_back(node);
+                        }
+                    }
+                }
+            }
+        }
+        num_nodes = std::max<int>(1, used_nodes.size());
+
+        // The CPUs are in ascending order, so the first hardware thread of a core gets rank 0
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (order[j].package == order[i].package && order[j].core == order[i].core) {
+                    ++order[i].sibling;
+                }
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [](const Cpu &a, const Cpu &b) {
+            return std::tie(a.sibling, a.node, a.package, a.core) < std::tie(b.sibling, b.node, b.package, b.core);
+        });
+    }
+};
+
+// Pin the calling thread to `cpu` for the scope, then restore its affinity; a negative `cpu` leaves it alone
+class ScopedPin {
+  private:
+    cpu_set_t saved;
+    bool pinned = false;
+
+  public:
+    explicit ScopedPin(int cpu) {
+        if (cpu >= 0 && pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0) {
+            pin_thread_to_core(cpu);
+            pinned = true;
+        }
+    }
+
+    ~ScopedPin() {
+        if (pinned) {
+            pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+        }
+    }
+
+    ScopedPin(const ScopedPin &) = delete;
+    ScopedPin &operator=(const ScopedPin &) = delete;
+};
+
+// CPU of the calling OpenMP thread's number, -1 if OMP_PROC_BIND already places the team
+inline int openmp_thread_cpu() {
+    return omp_get_proc_bind() == omp_proc_bind_false ? Topology::get().cpu(omp_get_thread_num()) : -1;
+}
+
+#endif
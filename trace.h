@@ -0,0 +1,143 @@
+/**
+ * Zero-copy replay of binary operation traces (see TraceHeader in
+ * generator.h). MappedTrace maps a trace read-only and hands out slices of
+ * the mapped Operation array, which batchAdd() consumes in place, so a trace
+ * of any size is replayed at memory bandwidth with no parsing or copying.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fenwick.h"
+#include "generator.h"
+
+class MappedTrace {
+  private:
+    void *mapping = MAP_FAILED;
+    size_t length = 0;
+    const TraceHeader *header = nullptr;
+    const Operation *records = nullptr;
+
+  public:
+    explicit MappedTrace(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TraceHeader)) {
+            length = st.st_size;
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // The mapping stays valid after the descriptor is closed
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            return;
+        }
+
+        header = static_cast<const TraceHeader *>(mapping);
+        if (!valid_trace_header(*header) || (length - sizeof(TraceHeader)) / sizeof(Operation) < header->count) {
+            header = nullptr;
+            return;
+        }
+        records = reinterpret_cast<const Operation *>(header + 1);
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+
+    ~MappedTrace() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, length);
+        }
+    }
+
+    MappedTrace(const MappedTrace &) = delete;
+    MappedTrace &operator=(const MappedTrace &) = delete;
+
+    // False if the file could not be mapped or is not a complete trace
+    bool ok() const {
+        return header != nullptr;
+    }
+
+    // Size of the tree the trace was recorded for
+    long long treeSize() const {
+        return header->size;
+    }
+
+    size_t size() const {
+        return header->count;
+    }
+
+    Span<const Operation> operations() const {
+        return Span<const Operation>(records, header->count);
+    }
+
+    // Up to `count` operations starting at `offset`, pointing into the mapping
+    Span<const Operation> slice(size_t offset, size_t count) const {
+        return operations().subspan(offset, count);
+    }
+};
+
+// Stream operations into a trace file batch by batch; the header count is patched on close()
+class TraceWriter {
+  private:
+    std::FILE *file;
+    TraceHeader header = {};
+
+  public:
+    TraceWriter(const std::string &path, long long size) : file(std::fopen(path.c_str(), "wb")) {
+        std::copy(trace_magic, trace_magic + 8, header.magic);
+        header.version = trace_version;
+        header.op_size = sizeof(Operation);
+        header.size = size;
+        if (file && std::fwrite(&header, sizeof(header), 1, file) != 1) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    ~TraceWriter() {
+        close();
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    bool ok() const {
+        return file != nullptr;
+    }
+
+    // A failed append closes the file, so that ok() and close() report the truncated trace
+    bool append(Span<const Operation> operations) {
+        if (!file) {
+            return false;
+        }
+        if (std::fwrite(operations.data(), sizeof(Operation), operations.size(), file) != operations.size()) {
+            std::fclose(file);
+            file = nullptr;
+            return false;
+        }
+        header.count += operations.size();
+        return true;
+    }
+
+    bool close() {
+        if (!file) {
+            return false;
+        }
+        bool result = std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+        result = std::fclose(file) == 0 && result;
+        file = nullptr;
+        return result;
+    }
+};
+
+#endif
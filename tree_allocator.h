@@ -0,0 +1,136 @@
+/**
+ * Storage of the tree nodes. Every block starts on a cache line, so node x
+ * of a tree sits at a fixed offset within its line and a range boundary
+ * that is a multiple of 64 / sizeof(T) never splits a line between two
+ * threads. Blocks of at least one huge page are mapped directly and,
+ * depending on the page policy, backed by huge pages: the prefix walks of
+ * a large tree stride by powers of two and touch a new 4 KB page at almost
+ * every step, a 2 MB page covers them with one TLB entry. Constructing an
+ * element without a value leaves it uninitialized, so the fresh pages stay
+ * untouched until their first write places them on the writer's NUMA node.
+ */
+#ifndef TREE_ALLOCATOR_H
+#define TREE_ALLOCATOR_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+
+constexpr size_t cache_line_size = 64;
+constexpr size_t huge_page_size = size_t(2) << 20;
+
+enum class PagePolicy {
+    Default,         // whatever the kernel's transparent huge page setting gives
+    TransparentHuge, // madvise(MADV_HUGEPAGE), for the "madvise" setting
+    HugeTLB,         // MAP_HUGETLB from the reserved pool, TransparentHuge if it is empty
+};
+
+// Policy of the blocks allocated from now on, read by every allocation
+inline PagePolicy &tree_page_policy() {
+    static PagePolicy policy = PagePolicy::Default;
+    return policy;
+}
+
+// Policy by name: default, thp or hugetlb; returns false for an unknown name
+inline bool parse_page_policy(const std::string &name, PagePolicy &policy) {
+    if (name == "default") {
+        policy = PagePolicy::Default;
+    } else if (name == "thp") {
+        policy = PagePolicy::TransparentHuge;
+    } else if (name == "hugetlb") {
+        policy = PagePolicy::HugeTLB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline size_t round_up(size_t bytes, size_t alignment) {
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+// The size alone decides between mmap and aligned_alloc, so deallocation needs no header
+inline void *allocate_tree_memory(size_t bytes) {
+    if (bytes < huge_page_size) {
+        void *p = std::aligned_alloc(cache_line_size, round_up(std::max<size_t>(bytes, 1), cache_line_size));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    const size_t length = round_up(bytes, huge_page_size);
+    const PagePolicy policy = tree_page_policy();
+    void *p = MAP_FAILED;
+    if (policy == PagePolicy::HugeTLB) {
+        p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        static bool warned = false;
+        if (p == MAP_FAILED && !warned) {
+            warned = true;
+            std::cerr << "MAP_HUGETLB failed, no huge pages reserved? Using transparent huge pages" << std::endl;
+        }
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (policy != PagePolicy::Default) {
+            madvise(p, length, MADV_HUGEPAGE);
+        }
+    }
+    return p;
+}
+
+inline void deallocate_tree_memory(void *p, size_t bytes) noexcept {
+    if (bytes < huge_page_size) {
+        std::free(p);
+    } else {
+        munmap(p, round_up(bytes, huge_page_size));
+    }
+}
+
+template <typename T>
+struct TreeAllocator {
+    using value_type = T;
+
+    TreeAllocator() = default;
+    template <typename U>
+    TreeAllocator(const TreeAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        static_assert(alignof(T) <= cache_line_size, "TreeAllocator aligns to cache lines only");
+        return static_cast<T *>(allocate_tree_memory(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        deallocate_tree_memory(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    void construct(U *p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+        ::new ((void *)p) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) {
+        ::new ((void *)p) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const TreeAllocator<U> &) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const TreeAllocator<U> &) const noexcept {
+        return false;
+    }
+};
+
+#endif